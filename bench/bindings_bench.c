@@ -0,0 +1,74 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bindings.h"
+
+// measures tm_binding_table_find() over a mix of bound and unbound keys, the same lookup
+// keyboard_handle_key() does on every key event
+//
+// usage: bindings-bench [bindings] [lookups]
+
+#define LOOKUP_STREAM 4096
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+    int     binding_count = argc > 1 ? atoi(argv[1]) : 128;
+    int64_t lookups       = argc > 2 ? atoll(argv[2]) : 50000000;
+
+    static const uint32_t modifiers[] = {
+        TM_MODIFIER_ALT,
+        TM_MODIFIER_LOGO,
+        TM_MODIFIER_CTRL | TM_MODIFIER_ALT,
+        TM_MODIFIER_LOGO | TM_MODIFIER_SHIFT,
+    };
+    const int modifier_count = sizeof(modifiers) / sizeof(modifiers[0]);
+
+    struct tm_binding_table* table = tm_binding_table_create();
+    if (table == NULL) {
+        return 1;
+    }
+
+    // printable keysyms starting at 'a', spread over the modifier sets
+    for (int i = 0; i < binding_count; i++) {
+        struct tm_binding binding = {
+            .modifiers = modifiers[i % modifier_count],
+            .sym       = 'a' + i / modifier_count,
+            .action    = TM_ACTION_FOCUS_NEXT,
+        };
+        tm_binding_table_add(table, &binding);
+    }
+
+    // roughly half the stream misses, like typing with a modifier held
+    struct {
+        uint32_t     modifiers;
+        xkb_keysym_t sym;
+    } stream[LOOKUP_STREAM];
+    srand(1);
+    for (int i = 0; i < LOOKUP_STREAM; i++) {
+        stream[i].modifiers = modifiers[rand() % modifier_count];
+        stream[i].sym       = 'a' + rand() % (binding_count / modifier_count * 2 + 1);
+    }
+
+    int64_t hits  = 0;
+    int64_t start = now_ns();
+    for (int64_t i = 0; i < lookups; i++) {
+        int j = i & (LOOKUP_STREAM - 1);
+        hits += tm_binding_table_find(table, stream[j].modifiers, stream[j].sym, false) != NULL;
+    }
+    int64_t elapsed = now_ns() - start;
+
+    printf("bindings=%d lookups=%" PRId64 " hits=%" PRId64 " %.2fns/lookup\n", binding_count,
+           lookups, hits, (double)elapsed / lookups);
+
+    tm_binding_table_destroy(table);
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "client.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include "connection.h"
+#include "xdg-shell-client-protocol.h"
+
+// synthetic xdg client for tm-bench: one toplevel redrawing its whole surface on a fixed timer,
+// independent of frame callbacks so the compositor sees a steady commit rate
+
+#define BENCH_BUFFER_COUNT 2
+
+struct bench_buffer {
+    struct wl_buffer* buffer;
+    uint32_t*         data;
+    bool              busy;
+};
+
+struct bench_client {
+    struct bench_connection connection;
+    struct wl_surface*      surface;
+    struct xdg_surface*     xdg_surface;
+    struct xdg_toplevel*    xdg_toplevel;
+    struct bench_buffer     buffers[BENCH_BUFFER_COUNT];
+    int                     width;
+    int                     height;
+    bool                    configured;
+    bool                    closed;
+    uint32_t                frame;
+};
+
+static void buffer_release(void* data, [[maybe_unused]] struct wl_buffer* wl_buffer) {
+    struct bench_buffer* buffer = data;
+    buffer->busy                = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static void xdg_surface_configure(void* data, struct xdg_surface* xdg_surface, uint32_t serial) {
+    struct bench_client* client = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+    client->configured = true;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+// the buffers keep the size the client was started with, configure sizes are ignored
+static void xdg_toplevel_configure([[maybe_unused]] void*                data,
+                                   [[maybe_unused]] struct xdg_toplevel* xdg_toplevel,
+                                   [[maybe_unused]] int32_t              width,
+                                   [[maybe_unused]] int32_t              height,
+                                   [[maybe_unused]] struct wl_array*     states) {}
+
+static void xdg_toplevel_close(void* data, [[maybe_unused]] struct xdg_toplevel* xdg_toplevel) {
+    struct bench_client* client = data;
+    client->closed              = true;
+}
+
+static void xdg_toplevel_configure_bounds([[maybe_unused]] void*                data,
+                                          [[maybe_unused]] struct xdg_toplevel* xdg_toplevel,
+                                          [[maybe_unused]] int32_t              width,
+                                          [[maybe_unused]] int32_t              height) {}
+
+static void xdg_toplevel_wm_capabilities([[maybe_unused]] void*                data,
+                                         [[maybe_unused]] struct xdg_toplevel* xdg_toplevel,
+                                         [[maybe_unused]] struct wl_array*     capabilities) {}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure        = xdg_toplevel_configure,
+    .close            = xdg_toplevel_close,
+    .configure_bounds = xdg_toplevel_configure_bounds,
+    .wm_capabilities  = xdg_toplevel_wm_capabilities,
+};
+
+static bool create_buffers(struct bench_client* client) {
+    int    stride = client->width * 4;
+    size_t size   = (size_t)stride * client->height;
+
+    uint8_t*            data;
+    struct wl_shm_pool* pool =
+        bench_shm_pool_create(&client->connection, size * BENCH_BUFFER_COUNT, &data);
+    if (pool == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < BENCH_BUFFER_COUNT; i++) {
+        struct bench_buffer* buffer = &client->buffers[i];
+        buffer->data                = (uint32_t*)(data + size * i);
+        buffer->buffer              = wl_shm_pool_create_buffer(pool, size * i, client->width,
+                                                                client->height, stride,
+                                                                WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+    }
+    wl_shm_pool_destroy(pool);
+    return true;
+}
+
+// redraws the whole surface with a new color if a buffer is free, the tick is dropped otherwise
+static void draw(struct bench_client* client) {
+    struct bench_buffer* buffer = NULL;
+    for (int i = 0; i < BENCH_BUFFER_COUNT; i++) {
+        if (!client->buffers[i].busy) {
+            buffer = &client->buffers[i];
+            break;
+        }
+    }
+    if (buffer == NULL) {
+        return;
+    }
+
+    uint32_t color = 0xff000000 | (client->frame * 0x010203);
+    for (int i = 0; i < client->width * client->height; i++) {
+        buffer->data[i] = color;
+    }
+    client->frame++;
+
+    buffer->busy = true;
+    wl_surface_attach(client->surface, buffer->buffer, 0, 0);
+    wl_surface_damage_buffer(client->surface, 0, 0, client->width, client->height);
+    wl_surface_commit(client->surface);
+}
+
+int bench_client_run(const char* socket, const struct bench_client_options* options) {
+    struct bench_client client = {
+        .width  = options->width,
+        .height = options->height,
+    };
+
+    struct bench_connection* connection = &client.connection;
+    if (!bench_connection_open(connection, socket)) {
+        if (connection->display == NULL) {
+            fprintf(stderr, "bench client: can't connect to %s\n", socket);
+        } else {
+            fprintf(stderr, "bench client: missing globals\n");
+        }
+        return 1;
+    }
+    if (!create_buffers(&client)) {
+        fprintf(stderr, "bench client: can't allocate shm buffers\n");
+        return 1;
+    }
+
+    client.surface      = wl_compositor_create_surface(connection->compositor);
+    client.xdg_surface  = xdg_wm_base_get_xdg_surface(connection->wm_base, client.surface);
+    client.xdg_toplevel = xdg_surface_get_toplevel(client.xdg_surface);
+    xdg_surface_add_listener(client.xdg_surface, &xdg_surface_listener, &client);
+    xdg_toplevel_add_listener(client.xdg_toplevel, &xdg_toplevel_listener, &client);
+    xdg_toplevel_set_title(client.xdg_toplevel, "tm-bench");
+    wl_surface_commit(client.surface);
+
+    while (!client.configured) {
+        if (wl_display_dispatch(connection->display) < 0) {
+            return 1;
+        }
+    }
+
+    draw(&client);
+
+    struct pollfd fds[2] = {
+        {.fd = wl_display_get_fd(connection->display), .events = POLLIN},
+        {.fd = bench_timer_create(options->rate > 0 ? options->rate : 1), .events = POLLIN},
+    };
+    if (fds[1].fd < 0) {
+        fprintf(stderr, "bench client: can't create the commit timer\n");
+        return 1;
+    }
+    while (!client.closed && bench_connection_dispatch(connection, fds, 2)) {
+        if (bench_timer_fired(&fds[1])) {
+            draw(&client);
+        }
+    }
+
+    close(fds[1].fd);
+    bench_connection_close(connection);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+struct bench_client_options {
+    int width;
+    int height;
+    // buffer commits per second
+    int rate;
+};
+
+// connects to the compositor on socket and commits shm buffers at the given rate until the
+// connection goes away, returns the process exit status
+int bench_client_run(const char* socket, const struct bench_client_options* options);
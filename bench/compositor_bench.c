@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/backend/headless.h>
+#include <wlr/render/pixman.h>
+
+#include "client.h"
+#include "server.h"
+
+// runs the compositor on the headless backend with synthetic clients forked next to it, and
+// prints the compositor's statistics and cpu time per frame after a fixed duration
+//
+// usage: tm-bench [-o outputs] [-c clients] [-r commits/s] [-d seconds] [-s WxH]
+
+struct bench {
+    int                         outputs;
+    int                         clients;
+    int                         duration_s;
+    struct bench_client_options client;
+    struct tm_server*           server;
+    struct wl_display*          display;
+    pid_t*                      client_pids;
+    struct wl_event_source*     finish;
+    struct timespec             cpu_start;
+    int64_t                     wall_start_ns;
+};
+
+static int64_t timespec_to_ns(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * 1000000000ll + ts->tv_nsec;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(&ts);
+}
+
+static bool parse_args(struct bench* bench, int argc, char** argv) {
+    bench->outputs       = 1;
+    bench->clients       = 8;
+    bench->duration_s    = 10;
+    bench->client.width  = 640;
+    bench->client.height = 480;
+    bench->client.rate   = 60;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:c:r:d:s:h")) != -1) {
+        switch (opt) {
+        case 'o': bench->outputs = atoi(optarg); break;
+        case 'c': bench->clients = atoi(optarg); break;
+        case 'r': bench->client.rate = atoi(optarg); break;
+        case 'd': bench->duration_s = atoi(optarg); break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &bench->client.width, &bench->client.height) == 2) {
+                break;
+            }
+            [[fallthrough]];
+        default:
+            fprintf(stderr,
+                    "usage: %s [-o outputs] [-c clients] [-r commits/s] [-d seconds] [-s WxH]\n",
+                    argv[0]);
+            return false;
+        }
+    }
+    return bench->outputs > 0 && bench->clients >= 0 && bench->duration_s > 0 &&
+           bench->client.width > 0 && bench->client.height > 0;
+}
+
+// software rendering into offscreen outputs, the numbers don't depend on the machine's gpu
+static bool create_backend([[maybe_unused]] void* data,
+                           struct wl_event_loop*  loop,
+                           struct wlr_backend**   backend,
+                           struct wlr_renderer**  renderer) {
+    *backend  = wlr_headless_backend_create(loop);
+    *renderer = wlr_pixman_renderer_create();
+    return *backend != NULL && *renderer != NULL;
+}
+
+static int finish(void* data) {
+    struct bench* bench = data;
+
+    struct timespec cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    int64_t  cpu_ns  = timespec_to_ns(&cpu_end) - timespec_to_ns(&bench->cpu_start);
+    int64_t  wall_ns = now_ns() - bench->wall_start_ns;
+    uint64_t frames  = tm_server_frame_count(bench->server);
+
+    tm_server_dump_stats(bench->server);
+    // compositor process only, the clients run in their own processes
+    printf("cpu: %.1fms over %.1fs (%.1f%%), %.3fms per frame over %" PRIu64 " frames\n",
+           cpu_ns / 1e6, wall_ns / 1e9, 100.0 * cpu_ns / wall_ns,
+           frames > 0 ? cpu_ns / 1e6 / frames : 0.0, frames);
+    fflush(stdout);
+
+    for (int i = 0; i < bench->clients; i++) {
+        if (bench->client_pids[i] > 0) {
+            kill(bench->client_pids[i], SIGTERM);
+            waitpid(bench->client_pids[i], NULL, 0);
+        }
+    }
+    wl_display_terminate(bench->display);
+    return 0;
+}
+
+static void started(void*               data,
+                    struct tm_server*   server,
+                    struct wl_display*  display,
+                    struct wlr_backend* backend,
+                    const char*         socket) {
+    struct bench* bench = data;
+    bench->server       = server;
+    bench->display      = display;
+
+    for (int i = 0; i < bench->outputs; i++) {
+        wlr_headless_add_output(backend, 1920, 1080);
+    }
+
+    bench->client_pids = calloc(bench->clients, sizeof(pid_t));
+    for (int i = 0; i < bench->clients; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            sigset_t set;
+            sigemptyset(&set);
+            sigprocmask(SIG_SETMASK, &set, NULL);
+            _exit(bench_client_run(socket, &bench->client));
+        }
+        bench->client_pids[i] = pid;
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &bench->cpu_start);
+    bench->wall_start_ns = now_ns();
+
+    bench->finish = wl_event_loop_add_timer(wl_display_get_event_loop(display), finish, bench);
+    wl_event_source_timer_update(bench->finish, bench->duration_s * 1000);
+
+    printf("bench: outputs=%d clients=%d size=%dx%d rate=%d duration=%ds\n", bench->outputs,
+           bench->clients, bench->client.width, bench->client.height, bench->client.rate,
+           bench->duration_s);
+}
+
+static void stopped(void* data) {
+    struct bench* bench = data;
+    wl_event_source_remove(bench->finish);
+    free(bench->client_pids);
+}
+
+int main(int argc, char** argv) {
+    struct bench bench = {0};
+    if (!parse_args(&bench, argc, argv)) {
+        return 1;
+    }
+
+    struct tm_server_hooks hooks = {
+        .data           = &bench,
+        .create_backend = create_backend,
+        .started        = started,
+        .stopped        = stopped,
+    };
+    return tm_server_run(&hooks);
+}
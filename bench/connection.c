@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+
+#include "connection.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include "xdg-shell-client-protocol.h"
+
+static void wm_base_ping([[maybe_unused]] void* data,
+                         struct xdg_wm_base*    wm_base,
+                         uint32_t               serial) {
+    xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+    .ping = wm_base_ping,
+};
+
+static void registry_global(void*               data,
+                            struct wl_registry* registry,
+                            uint32_t            name,
+                            const char*         interface,
+                            uint32_t            version) {
+    struct bench_connection* connection = data;
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        connection->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        connection->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        connection->wm_base =
+            wl_registry_bind(registry, name, &xdg_wm_base_interface, version < 4 ? version : 4);
+        xdg_wm_base_add_listener(connection->wm_base, &wm_base_listener, connection);
+    }
+}
+
+static void registry_global_remove([[maybe_unused]] void*               data,
+                                   [[maybe_unused]] struct wl_registry* registry,
+                                   [[maybe_unused]] uint32_t            name) {}
+
+static const struct wl_registry_listener registry_listener = {
+    .global        = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+bool bench_connection_open(struct bench_connection* connection, const char* socket) {
+    *connection         = (struct bench_connection){0};
+    connection->display = wl_display_connect(socket);
+    if (connection->display == NULL) {
+        return false;
+    }
+
+    struct wl_registry* registry = wl_display_get_registry(connection->display);
+    wl_registry_add_listener(registry, &registry_listener, connection);
+    wl_display_roundtrip(connection->display);
+    return connection->compositor != NULL && connection->shm != NULL &&
+           connection->wm_base != NULL;
+}
+
+void bench_connection_close(struct bench_connection* connection) {
+    if (connection->display != NULL) {
+        wl_display_disconnect(connection->display);
+        connection->display = NULL;
+    }
+}
+
+struct wl_shm_pool* bench_shm_pool_create(struct bench_connection* connection,
+                                          size_t                   size,
+                                          uint8_t**                data) {
+    int fd = memfd_create("tm-client", MFD_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (*data == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    struct wl_shm_pool* pool = wl_shm_create_pool(connection->shm, fd, size);
+    close(fd);
+    return pool;
+}
+
+int bench_timer_create(int rate) {
+    if (rate <= 0) {
+        return -1;
+    }
+
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer < 0) {
+        return -1;
+    }
+
+    long              interval = 1000000000l / rate;
+    struct itimerspec spec     = {0};
+    spec.it_interval.tv_sec    = interval / 1000000000l;
+    spec.it_interval.tv_nsec   = interval % 1000000000l;
+    spec.it_value              = spec.it_interval;
+    if (timerfd_settime(timer, 0, &spec, NULL) != 0) {
+        close(timer);
+        return -1;
+    }
+    return timer;
+}
+
+bool bench_timer_fired(struct pollfd* fd) {
+    uint64_t expirations;
+    return (fd->revents & POLLIN) &&
+           read(fd->fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+}
+
+bool bench_connection_dispatch(struct bench_connection* connection,
+                               struct pollfd*           fds,
+                               int                      count) {
+    struct wl_display* display = connection->display;
+    while (wl_display_prepare_read(display) != 0) {
+        wl_display_dispatch_pending(display);
+    }
+    if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+        wl_display_cancel_read(display);
+        return false;
+    }
+
+    if (poll(fds, count, -1) < 0) {
+        bool interrupted = errno == EINTR;
+        wl_display_cancel_read(display);
+        // revents are stale after a failed poll, an interrupted one is just an empty round
+        for (int i = 0; i < count; i++) {
+            fds[i].revents = 0;
+        }
+        return interrupted;
+    }
+
+    if (fds[0].revents & POLLIN) {
+        if (wl_display_read_events(display) < 0) {
+            return false;
+        }
+    } else {
+        wl_display_cancel_read(display);
+    }
+    if (fds[0].revents & (POLLERR | POLLHUP)) {
+        return false;
+    }
+    return wl_display_dispatch_pending(display) >= 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// wayland client plumbing shared by the tm-bench clients and test-server: globals, shm pools,
+// timers and the poll loop around the display fd
+
+struct bench_connection {
+    struct wl_display*    display;
+    struct wl_compositor* compositor;
+    struct wl_shm*        shm;
+    struct xdg_wm_base*   wm_base;
+};
+
+// connects to socket, or WAYLAND_DISPLAY when it is NULL, binds the globals and answers pings.
+// false when the connection fails, display is NULL then, or when a global is missing
+bool bench_connection_open(struct bench_connection* connection, const char* socket);
+
+void bench_connection_close(struct bench_connection* connection);
+
+// a pool backed by a fresh memfd of size bytes, mapped into data
+struct wl_shm_pool* bench_shm_pool_create(struct bench_connection* connection,
+                                          size_t                   size,
+                                          uint8_t**                data);
+
+// periodic timerfd firing rate times per second, -1 when rate is not positive or the timer
+// can't be created
+int bench_timer_create(int rate);
+
+bool bench_timer_fired(struct pollfd* fd);
+
+// flushes, waits on fds and dispatches what arrived on the display, fds[0] has to be the display
+// fd. the other revents are left for the caller, false once the connection is gone
+bool bench_connection_dispatch(struct bench_connection* connection,
+                               struct pollfd*           fds,
+                               int                      count);
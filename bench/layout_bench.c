@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "layout.h"
+
+// measures tm_layout_arrange() over a tree of nested splits and stacks, for a full relayout
+// after an output change and for the incremental passes done on map, unmap and resize
+//
+// usage: layout-bench [windows] [passes]
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+struct pass_stats {
+    int64_t elapsed_ns;
+    int64_t visited;
+    int64_t changed;
+    int64_t passes;
+};
+
+static void timed_arrange(struct tm_layout* layout, struct pass_stats* stats) {
+    int64_t                start = now_ns();
+    struct tm_layout_node* node  = tm_layout_arrange(layout);
+    stats->elapsed_ns += now_ns() - start;
+    // what the compositor does next, one configure per changed leaf
+    for (; node != NULL; node = node->changed_next) {
+        stats->changed++;
+    }
+    stats->visited += layout->visited;
+    stats->passes++;
+}
+
+static void print_stats(const char* label, const struct pass_stats* stats) {
+    printf("%-8s %8.2fus/pass %8.1f nodes/pass %8.1f configures/pass\n", label,
+           (double)stats->elapsed_ns / stats->passes / 1000.0,
+           (double)stats->visited / stats->passes, (double)stats->changed / stats->passes);
+}
+
+int main(int argc, char** argv) {
+    int window_count = argc > 1 ? atoi(argv[1]) : 500;
+    int passes       = argc > 2 ? atoi(argv[2]) : 10000;
+    if (window_count < 2 || passes < 1) {
+        fprintf(stderr, "usage: layout-bench [windows >= 2] [passes]\n");
+        return 1;
+    }
+
+    struct tm_layout layout;
+    struct tm_layout_node** leaves = calloc(window_count, sizeof(struct tm_layout_node*));
+    if (leaves == NULL || !tm_layout_init(&layout)) {
+        return 1;
+    }
+    tm_layout_set_area(&layout, (struct tm_layout_box){0, 0, 3840, 2160});
+
+    // every few windows the one next to it is split first, which nests the tree a few levels
+    // deep like a long lived session does
+    srand(1);
+    for (int i = 0; i < window_count; i++) {
+        struct tm_layout_node* sibling = i > 0 ? leaves[rand() % i] : NULL;
+        if (sibling != NULL && i % 4 == 0) {
+            tm_layout_split(&layout, sibling, i % 32 == 0 ? TM_LAYOUT_STACK
+                                              : i % 8 == 0 ? TM_LAYOUT_SPLIT_H
+                                                           : TM_LAYOUT_SPLIT_V);
+        }
+        leaves[i] = tm_layout_insert(&layout, sibling, NULL);
+        if (leaves[i] == NULL) {
+            return 1;
+        }
+    }
+    tm_layout_arrange(&layout);
+
+    struct pass_stats full = {0};
+    for (int i = 0; i < passes; i++) {
+        tm_layout_set_area(&layout, (struct tm_layout_box){0, 0, i & 1 ? 2560 : 3840, 2160});
+        timed_arrange(&layout, &full);
+    }
+
+    // unmap a window and map it again next to a random one
+    struct pass_stats map = {0};
+    for (int i = 0; i < passes; i++) {
+        int j = rand() % window_count;
+        tm_layout_remove(&layout, leaves[j]);
+        timed_arrange(&layout, &map);
+        leaves[j] = tm_layout_insert(&layout, leaves[(j + 1 + rand() % (window_count - 1)) %
+                                                     window_count],
+                                     NULL);
+        if (leaves[j] == NULL) {
+            return 1;
+        }
+        timed_arrange(&layout, &map);
+    }
+
+    struct pass_stats resize = {0};
+    for (int i = 0; i < passes; i++) {
+        struct tm_layout_node* leaf = leaves[rand() % window_count];
+        tm_layout_set_size(&layout, leaf, leaf->box.width + (i & 1 ? 16 : -16),
+                           leaf->box.height + (i & 1 ? 16 : -16));
+        timed_arrange(&layout, &resize);
+    }
+
+    printf("windows=%d passes=%d\n", window_count, passes);
+    print_stats("full", &full);
+    print_stats("map", &map);
+    print_stats("resize", &resize);
+
+    tm_layout_finish(&layout);
+    free(leaves);
+    return 0;
+}
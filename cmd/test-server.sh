@@ -1,2 +1,2 @@
 #!/bin/sh
-gcc -o ../out/test-server ../test-server/entry.c  -lwayland-server ; ./../out/test-server
+cd ../out/release ; make test-server && ./test-server "$@"
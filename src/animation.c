@@ -0,0 +1,147 @@
+#include "animation.h"
+
+#include <stddef.h>
+
+double tm_ease(enum tm_easing easing, double t) {
+    if (t <= 0.0) {
+        return 0.0;
+    }
+    if (t >= 1.0) {
+        return 1.0;
+    }
+
+    switch (easing) {
+    case TM_EASE_LINEAR:
+        return t;
+    case TM_EASE_OUT_CUBIC: {
+        double u = 1.0 - t;
+        return 1.0 - u * u * u;
+    }
+    case TM_EASE_IN_CUBIC:
+        return t * t * t;
+    case TM_EASE_IN_OUT_CUBIC: {
+        if (t < 0.5) {
+            return 4.0 * t * t * t;
+        }
+        double u = -2.0 * t + 2.0;
+        return 1.0 - u * u * u / 2.0;
+    }
+    }
+    return t;
+}
+
+static double lerp(double from, double to, double t) {
+    return from + (to - from) * t;
+}
+
+static void interpolate(const struct tm_animation* animation,
+                        int64_t                    now_ns,
+                        struct tm_animation_state* state) {
+    double t = animation->duration_ns > 0
+                   ? (double)(now_ns - animation->start_ns) / animation->duration_ns
+                   : 1.0;
+    t        = tm_ease(animation->easing, t);
+
+    state->x       = lerp(animation->from.x, animation->to.x, t);
+    state->y       = lerp(animation->from.y, animation->to.y, t);
+    state->width   = lerp(animation->from.width, animation->to.width, t);
+    state->height  = lerp(animation->from.height, animation->to.height, t);
+    state->opacity = lerp(animation->from.opacity, animation->to.opacity, t);
+}
+
+static struct tm_animation* find(const struct tm_animator* animator, const void* target) {
+    int seen = 0;
+    for (int i = 0; i < TM_ANIMATION_SLOTS && seen < animator->active; i++) {
+        const struct tm_animation* animation = &animator->slots[i];
+        if (!animation->active) {
+            continue;
+        }
+        if (animation->target == target) {
+            return (struct tm_animation*)animation;
+        }
+        seen++;
+    }
+    return NULL;
+}
+
+bool tm_animation_start(struct tm_animator*              animator,
+                        void*                            target,
+                        int                              kind,
+                        enum tm_easing                   easing,
+                        int64_t                          now_ns,
+                        int64_t                          duration_ns,
+                        const struct tm_animation_state* from,
+                        const struct tm_animation_state* to) {
+    struct tm_animation* animation = find(animator, target);
+    for (int i = 0; animation == NULL && i < TM_ANIMATION_SLOTS; i++) {
+        if (!animator->slots[i].active) {
+            animation = &animator->slots[i];
+            animator->active++;
+        }
+    }
+    if (animation == NULL) {
+        return false;
+    }
+
+    *animation = (struct tm_animation){
+        .active      = true,
+        .target      = target,
+        .kind        = kind,
+        .easing      = easing,
+        .start_ns    = now_ns,
+        .duration_ns = duration_ns,
+        .from        = *from,
+        .to          = *to,
+    };
+    return true;
+}
+
+bool tm_animation_current(const struct tm_animator*  animator,
+                          const void*                target,
+                          int64_t                    now_ns,
+                          struct tm_animation_state* state) {
+    const struct tm_animation* animation = find(animator, target);
+    if (animation == NULL) {
+        return false;
+    }
+    interpolate(animation, now_ns, state);
+    return true;
+}
+
+void tm_animation_cancel(struct tm_animator* animator, const void* target) {
+    struct tm_animation* animation = find(animator, target);
+    if (animation != NULL) {
+        animation->active = false;
+        animator->active--;
+    }
+}
+
+bool tm_animation_step(struct tm_animator*       animator,
+                       int64_t                   now_ns,
+                       tm_animation_apply_func_t apply,
+                       void*                     data) {
+    for (int i = 0; i < TM_ANIMATION_SLOTS && animator->active > 0; i++) {
+        struct tm_animation* animation = &animator->slots[i];
+        if (!animation->active) {
+            continue;
+        }
+
+        // late frames skip ahead instead of stretching the animation
+        bool                      done = now_ns - animation->start_ns >= animation->duration_ns;
+        struct tm_animation_state state;
+        if (done) {
+            state = animation->to;
+        } else {
+            interpolate(animation, now_ns, &state);
+        }
+
+        // freed before the callback, which may start a new animation in the same slot
+        struct tm_animation current = *animation;
+        if (done) {
+            animation->active = false;
+            animator->active--;
+        }
+        apply(&current, &state, done, data);
+    }
+    return animator->active > 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// fixed pool of time based animations stepped from the output frame handler. nothing is
+// allocated after the pool, and the caller applies the interpolated values to its scene nodes
+
+#define TM_ANIMATION_SLOTS 64
+
+enum tm_easing {
+    TM_EASE_LINEAR,
+    TM_EASE_OUT_CUBIC,
+    TM_EASE_IN_CUBIC,
+    TM_EASE_IN_OUT_CUBIC,
+};
+
+// which fields mean something is up to the caller, all of them are interpolated
+struct tm_animation_state {
+    double x;
+    double y;
+    double width;
+    double height;
+    double opacity;
+};
+
+struct tm_animation {
+    bool                      active;
+    // one animation per target, starting another one replaces it
+    void*                     target;
+    // caller defined, tells the apply callback what target points to
+    int                       kind;
+    enum tm_easing            easing;
+    int64_t                   start_ns;
+    int64_t                   duration_ns;
+    struct tm_animation_state from;
+    struct tm_animation_state to;
+};
+
+struct tm_animator {
+    struct tm_animation slots[TM_ANIMATION_SLOTS];
+    int                 active;
+};
+
+// done is set on the last call for an animation, state is then exactly its to state
+typedef void (*tm_animation_apply_func_t)(const struct tm_animation*       animation,
+                                          const struct tm_animation_state* state,
+                                          bool                             done,
+                                          void*                            data);
+
+double tm_ease(enum tm_easing easing, double t);
+
+// replaces a running animation of target, false when every slot is busy
+bool tm_animation_start(struct tm_animator*              animator,
+                        void*                            target,
+                        int                              kind,
+                        enum tm_easing                   easing,
+                        int64_t                          now_ns,
+                        int64_t                          duration_ns,
+                        const struct tm_animation_state* from,
+                        const struct tm_animation_state* to);
+
+// fills state with where target's animation is at now_ns, false if it isn't animating
+bool tm_animation_current(const struct tm_animator*  animator,
+                          const void*                target,
+                          int64_t                    now_ns,
+                          struct tm_animation_state* state);
+
+// drops target's animation without applying anything
+void tm_animation_cancel(struct tm_animator* animator, const void* target);
+
+// applies every animation at now_ns and frees the finished ones, true while any is left
+bool tm_animation_step(struct tm_animator*       animator,
+                       int64_t                   now_ns,
+                       tm_animation_apply_func_t apply,
+                       void*                     data);
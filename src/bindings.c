@@ -0,0 +1,308 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bindings.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define TM_BINDING_TABLE_MIN_CAPACITY 16
+
+struct tm_binding_slot {
+    // 0 marks an empty slot, XKB_KEY_NoSymbol is never bound so no real key maps to it
+    uint64_t          key;
+    struct tm_binding binding;
+};
+
+struct tm_binding_table {
+    struct tm_binding_slot* slots;
+    uint32_t                capacity;
+    uint32_t                count;
+    uint32_t                shift;
+};
+
+static uint64_t binding_key(uint32_t modifiers, xkb_keysym_t sym, bool release) {
+    return ((uint64_t)((modifiers & 0xff) | (release ? 0x100 : 0)) << 32) | sym;
+}
+
+// fibonacci hashing, the top bits of the product index a power of two table
+static uint32_t binding_slot(const struct tm_binding_table* table, uint64_t key) {
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> table->shift);
+}
+
+static bool table_resize(struct tm_binding_table* table, uint32_t capacity) {
+    struct tm_binding_slot* slots = calloc(capacity, sizeof(struct tm_binding_slot));
+    if (slots == NULL) {
+        return false;
+    }
+
+    struct tm_binding_slot* old_slots    = table->slots;
+    uint32_t                old_capacity = table->capacity;
+
+    table->slots    = slots;
+    table->capacity = capacity;
+    table->shift    = 64 - __builtin_ctz(capacity);
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].key == 0) {
+            continue;
+        }
+        uint32_t slot = binding_slot(table, old_slots[i].key);
+        while (table->slots[slot].key != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        table->slots[slot] = old_slots[i];
+    }
+
+    free(old_slots);
+    return true;
+}
+
+struct tm_binding_table* tm_binding_table_create(void) {
+    struct tm_binding_table* table = calloc(1, sizeof(struct tm_binding_table));
+    if (table == NULL) {
+        return NULL;
+    }
+    if (!table_resize(table, TM_BINDING_TABLE_MIN_CAPACITY)) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+static void binding_finish(struct tm_binding* binding) {
+    free(binding->command);
+    if (binding->chord != NULL) {
+        tm_binding_table_destroy(binding->chord);
+    }
+}
+
+void tm_binding_table_destroy(struct tm_binding_table* table) {
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].key != 0) {
+            binding_finish(&table->slots[i].binding);
+        }
+    }
+    free(table->slots);
+    free(table);
+}
+
+bool tm_binding_table_add(struct tm_binding_table* table, const struct tm_binding* binding) {
+    // stay at most half full so probe sequences remain short
+    if ((table->count + 1) * 2 > table->capacity &&
+        !table_resize(table, table->capacity * 2)) {
+        return false;
+    }
+
+    uint64_t key  = binding_key(binding->modifiers, binding->sym, binding->release);
+    uint32_t slot = binding_slot(table, key);
+    while (table->slots[slot].key != 0 && table->slots[slot].key != key) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    if (table->slots[slot].key == key) {
+        binding_finish(&table->slots[slot].binding);
+    } else {
+        table->count++;
+    }
+    table->slots[slot].key     = key;
+    table->slots[slot].binding = *binding;
+    return true;
+}
+
+const struct tm_binding* tm_binding_table_find(const struct tm_binding_table* table,
+                                               uint32_t                       modifiers,
+                                               xkb_keysym_t                   sym,
+                                               bool                           release) {
+    uint64_t key  = binding_key(modifiers, sym, release);
+    uint32_t slot = binding_slot(table, key);
+    while (table->slots[slot].key != 0) {
+        if (table->slots[slot].key == key) {
+            return &table->slots[slot].binding;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return NULL;
+}
+
+static bool parse_modifier(const char* name, size_t len, uint32_t* modifiers) {
+    static const struct {
+        const char* name;
+        uint32_t    modifier;
+    } names[] = {
+        {"Shift", TM_MODIFIER_SHIFT},
+        {"Ctrl",  TM_MODIFIER_CTRL },
+        {"Alt",   TM_MODIFIER_ALT  },
+        {"Logo",  TM_MODIFIER_LOGO },
+        {"Super", TM_MODIFIER_LOGO },
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i].name) == len && strncasecmp(names[i].name, name, len) == 0) {
+            *modifiers |= names[i].modifier;
+            return true;
+        }
+    }
+    return false;
+}
+
+// parses "Mod+Mod+keysym" into binding's modifiers and sym
+static bool parse_combo(const char* combo, struct tm_binding* binding) {
+    binding->modifiers = 0;
+
+    const char* plus;
+    while ((plus = strchr(combo, '+')) != NULL && plus[1] != '\0') {
+        if (!parse_modifier(combo, plus - combo, &binding->modifiers)) {
+            fprintf(stderr, "unknown modifier in binding: %.*s\n", (int)(plus - combo), combo);
+            return false;
+        }
+        combo = plus + 1;
+    }
+
+    binding->sym = xkb_keysym_to_lower(xkb_keysym_from_name(combo, XKB_KEYSYM_CASE_INSENSITIVE));
+    if (binding->sym == XKB_KEY_NoSymbol) {
+        fprintf(stderr, "unknown keysym in binding: %s\n", combo);
+        return false;
+    }
+    return true;
+}
+
+static bool parse_action(char* action, char* args, struct tm_binding* binding) {
+    if (strcmp(action, "quit") == 0) {
+        binding->action = TM_ACTION_QUIT;
+    } else if (strcmp(action, "focus-next") == 0) {
+        binding->action = TM_ACTION_FOCUS_NEXT;
+    } else if (strcmp(action, "exec") == 0 && args != NULL && *args != '\0') {
+        binding->action  = TM_ACTION_EXEC;
+        binding->command = strdup(args);
+    } else if (strcmp(action, "workspace") == 0 || strcmp(action, "move-to-workspace") == 0) {
+        binding->action    = action[0] == 'w' ? TM_ACTION_WORKSPACE : TM_ACTION_MOVE_TO_WORKSPACE;
+        binding->workspace = args != NULL ? atoi(args) : 0;
+        if (binding->workspace < 1) {
+            fprintf(stderr, "%s needs a workspace number\n", action);
+            return false;
+        }
+    } else if (strcmp(action, "layout") == 0 && args != NULL) {
+        binding->action = TM_ACTION_LAYOUT;
+        if (strcmp(args, "splith") == 0) {
+            binding->layout = TM_LAYOUT_SPLIT_H;
+        } else if (strcmp(args, "splitv") == 0) {
+            binding->layout = TM_LAYOUT_SPLIT_V;
+        } else if (strcmp(args, "stack") == 0) {
+            binding->layout = TM_LAYOUT_STACK;
+        } else {
+            fprintf(stderr, "layout is splith, splitv or stack: %s\n", args);
+            return false;
+        }
+    } else if (strcmp(action, "split") == 0 && args != NULL &&
+               (strcmp(args, "h") == 0 || strcmp(args, "v") == 0)) {
+        binding->action = TM_ACTION_SPLIT;
+        binding->layout = args[0] == 'h' ? TM_LAYOUT_SPLIT_H : TM_LAYOUT_SPLIT_V;
+    } else {
+        fprintf(stderr, "unknown binding action: %s\n", action);
+        return false;
+    }
+    return true;
+}
+
+// returns the table the last combo of a chord lives in, creating the prefixes on the way
+static struct tm_binding_table* chord_table(struct tm_binding_table* table,
+                                            struct tm_binding*       prefix) {
+    const struct tm_binding* existing =
+        tm_binding_table_find(table, prefix->modifiers, prefix->sym, false);
+    if (existing != NULL && existing->action == TM_ACTION_CHORD) {
+        return existing->chord;
+    }
+
+    prefix->action = TM_ACTION_CHORD;
+    prefix->chord  = tm_binding_table_create();
+    if (prefix->chord == NULL || !tm_binding_table_add(table, prefix)) {
+        if (prefix->chord != NULL) {
+            tm_binding_table_destroy(prefix->chord);
+        }
+        return NULL;
+    }
+    return prefix->chord;
+}
+
+bool tm_bindings_parse_line(struct tm_binding_table* root, const char* line) {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", line);
+    buf[strcspn(buf, "\r\n")] = '\0';
+
+    char* save    = NULL;
+    char* command = strtok_r(buf, " \t", &save);
+    if (command == NULL || command[0] == '#') {
+        return true;
+    }
+    if (strcmp(command, "bind") != 0) {
+        fprintf(stderr, "unknown config command: %s\n", command);
+        return false;
+    }
+
+    struct tm_binding binding = {0};
+
+    char* combos = strtok_r(NULL, " \t", &save);
+    if (combos != NULL && strcmp(combos, "--release") == 0) {
+        binding.release = true;
+        combos          = strtok_r(NULL, " \t", &save);
+    }
+    char* action = strtok_r(NULL, " \t", &save);
+    if (combos == NULL || action == NULL) {
+        fprintf(stderr, "incomplete binding: %s\n", line);
+        return false;
+    }
+    char* args = save;
+    while (args != NULL && isspace((unsigned char)*args)) {
+        args++;
+    }
+
+    // every combo but the last one is a chord prefix
+    struct tm_binding_table* table = root;
+    char*                    combo_save;
+    char*                    combo = strtok_r(combos, ",", &combo_save);
+    char*                    next  = strtok_r(NULL, ",", &combo_save);
+    while (next != NULL) {
+        if (binding.release) {
+            fprintf(stderr, "release bindings can't be chords: %s\n", line);
+            return false;
+        }
+
+        struct tm_binding prefix = {0};
+        if (!parse_combo(combo, &prefix) || (table = chord_table(table, &prefix)) == NULL) {
+            return false;
+        }
+        combo = next;
+        next  = strtok_r(NULL, ",", &combo_save);
+    }
+
+    if (!parse_combo(combo, &binding) || !parse_action(action, args, &binding)) {
+        return false;
+    }
+    if (!tm_binding_table_add(table, &binding)) {
+        free(binding.command);
+        return false;
+    }
+    return true;
+}
+
+bool tm_bindings_load(struct tm_binding_table* root, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    char line[1024];
+    int  line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        if (!tm_bindings_parse_line(root, line)) {
+            fprintf(stderr, "%s:%d: binding ignored\n", path, line_number);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
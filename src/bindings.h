@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "layout.h"
+
+// same bit values as enum wlr_keyboard_modifier, so wlroots masks can be used as is
+enum tm_modifier {
+    TM_MODIFIER_SHIFT = 1 << 0,
+    TM_MODIFIER_CAPS  = 1 << 1,
+    TM_MODIFIER_CTRL  = 1 << 2,
+    TM_MODIFIER_ALT   = 1 << 3,
+    TM_MODIFIER_MOD2  = 1 << 4,
+    TM_MODIFIER_MOD3  = 1 << 5,
+    TM_MODIFIER_LOGO  = 1 << 6,
+    TM_MODIFIER_MOD5  = 1 << 7,
+};
+
+// lock modifiers like caps and num lock never take part in a binding
+#define TM_BINDING_MODIFIER_MASK                                                                   \
+    (TM_MODIFIER_SHIFT | TM_MODIFIER_CTRL | TM_MODIFIER_ALT | TM_MODIFIER_LOGO)
+
+enum tm_action {
+    TM_ACTION_NONE,
+    TM_ACTION_QUIT,
+    TM_ACTION_FOCUS_NEXT,
+    TM_ACTION_EXEC,
+    TM_ACTION_WORKSPACE,
+    TM_ACTION_MOVE_TO_WORKSPACE,
+    // tiling, binding.layout is the container kind
+    TM_ACTION_LAYOUT,
+    TM_ACTION_SPLIT,
+    // prefix of a chord, the next key press is looked up in binding.chord
+    TM_ACTION_CHORD,
+};
+
+struct tm_binding_table;
+
+struct tm_binding {
+    uint32_t                 modifiers;
+    xkb_keysym_t             sym;
+    bool                     release;
+    enum tm_action           action;
+    char*                    command;
+    // 1-based as written in the config, the compositor checks the range
+    int                      workspace;
+    enum tm_layout_kind      layout;
+    struct tm_binding_table* chord;
+};
+
+struct tm_binding_table* tm_binding_table_create(void);
+void                     tm_binding_table_destroy(struct tm_binding_table* table);
+
+// takes ownership of command and chord, replaces an existing binding for the same key
+bool tm_binding_table_add(struct tm_binding_table* table, const struct tm_binding* binding);
+
+// one probe sequence in an open-addressed table, modifiers are masked and sym lowercased by
+// the caller
+const struct tm_binding* tm_binding_table_find(const struct tm_binding_table* table,
+                                               uint32_t                       modifiers,
+                                               xkb_keysym_t                   sym,
+                                               bool                           release);
+
+// parses one config line like "bind [--release] Alt+x[,Ctrl+y...] action [args]", blank lines
+// and lines starting with # are accepted and ignored
+bool tm_bindings_parse_line(struct tm_binding_table* root, const char* line);
+
+// loads every line of path into root, false if the file can't be read
+bool tm_bindings_load(struct tm_binding_table* root, const char* path);
@@ -1,28 +1,53 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
 #include <wlr/render/allocator.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_commit_timing_v1.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_data_device.h>
+#include <wlr/types/wlr_ext_image_capture_source_v1.h>
+#include <wlr/types/wlr_ext_image_copy_capture_v1.h>
+#include <wlr/types/wlr_fifo_v1.h>
 #include <wlr/types/wlr_input_device.h>
 #include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_linux_dmabuf_v1.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_output_swapchain_manager.h>
 #include <wlr/types/wlr_pointer.h>
+#include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_screencopy_v1.h>
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_subcompositor.h>
+#include <wlr/types/wlr_tearing_control_v1.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/log.h>
 
+#include "animation.h"
+#include "bindings.h"
+#include "histogram.h"
+#include "layout.h"
+#include "server.h"
+
 enum tm_cursor_mode {
     TM_CURSOR_PASSTHROUGH,
     TM_CURSOR_MOVE,
@@ -30,52 +55,275 @@ enum tm_cursor_mode {
 
 };
 
+// what the target of an animation points to, see animation_apply
+enum tm_animation_kind {
+    // a struct tm_top_level fading in after it mapped
+    TM_ANIMATE_OPEN,
+    // a struct tm_closing fading out and shrinking
+    TM_ANIMATE_CLOSE,
+    // a struct tm_workspace sliding in or out
+    TM_ANIMATE_WORKSPACE,
+};
+
+// how interactive resize paces configures
+enum tm_resize_mode {
+    // one configure per motion event
+    TM_RESIZE_PER_EVENT,
+    // at most one unacknowledged configure per top-level, motion in between is merged
+    TM_RESIZE_ACK,
+    // at most one configure per output frame
+    TM_RESIZE_FRAME,
+};
+
+// when an output runs with adaptive sync, so frames go out at the client's cadence instead of
+// waiting for the next fixed vblank
+enum tm_adaptive_sync_policy {
+    TM_ADAPTIVE_SYNC_OFF,
+    TM_ADAPTIVE_SYNC_ALWAYS,
+    // while the focused top-level is fullscreen on the output
+    TM_ADAPTIVE_SYNC_FULLSCREEN,
+};
+
+// number of recent scene commit costs the repaint delay is estimated from
+#define TM_RENDER_TIME_SAMPLES 16
+// headroom left between the estimated end of the repaint and the vblank
+#define TM_REPAINT_MARGIN_NS 2000000
+// frames to repaint right away after a delayed repaint missed its vblank
+#define TM_REPAINT_BACKOFF_FRAMES 60
+
+// top-level hit testing goes through a uniform grid of layout space hashed into a fixed number of
+// buckets, so outputs far apart or at negative coordinates need no bounds
+#define TM_GRID_CELL_SIZE 256
+#define TM_GRID_BUCKETS 512
+// more overlapping top-levels under one point than this falls back to walking the scene
+#define TM_GRID_MAX_CANDIDATES 32
+
+// virtual workspaces, Alt+1..Alt+9 and Alt+0 switch between them by default
+#define TM_WORKSPACE_COUNT 10
+
+struct tm_grid_entry {
+    struct wl_list       link;
+    struct tm_top_level* top_level;
+    int                  cell_x;
+    int                  cell_y;
+};
+
+// a copy of one client buffer in a snapshot, box is where it was relative to the live tree
+// when the snapshot was taken
+struct tm_snapshot_buffer {
+    struct wlr_scene_buffer* buffer;
+    struct wlr_box           box;
+};
+
+// copies of a top-level's buffers that can be stretched over any box, see snapshot_scale.
+// geometry is the window geometry they were drawn at
+struct tm_snapshot {
+    struct wlr_scene_tree*     tree;
+    struct wlr_box             geometry;
+    struct tm_snapshot_buffer* buffers;
+    int                        count;
+    int                        capacity;
+};
+
+// what stays of an unmapped top-level while it fades out, owned by the server since the
+// top-level itself may be destroyed right after
+struct tm_closing {
+    struct wl_list     link;
+    struct tm_snapshot snapshot;
+};
+
+// each workspace is a scene subtree, inactive ones are disabled so the scene skips them for
+// rendering, damage, input and frame callbacks, and switching is two node updates
+struct tm_workspace {
+    struct wlr_scene_tree* tree;
+    // children of tree, fullscreen top-levels are reparented above every normal one
+    struct wlr_scene_tree* layer_normal;
+    struct wlr_scene_tree* layer_fullscreen;
+    // mapped top-levels, most recently focused first
+    struct wl_list         top_levels;
+    // hit testing index, see TM_GRID_CELL_SIZE
+    struct wl_list         grid[TM_GRID_BUCKETS];
+    // tiles of the top-levels that aren't floating, only used in tiling mode. they fill the
+    // usable area of output, the one under the pointer when the first tile was inserted
+    struct tm_layout       layout;
+    struct tm_output*      output;
+};
+
+// compiled keymap shared by every keyboard using the same RMLVO names
+struct tm_keymap {
+    struct wl_list     link;
+    char*              names;
+    struct xkb_keymap* keymap;
+};
+
+// accumulated by occlusion_add_buffer over one top-level, in layout coordinates
+struct tm_occlusion {
+    pixman_region32_t area;
+    pixman_region32_t opaque;
+};
+
+// modes an output being enabled tries, best first, until the backend accepts the configuration
+struct tm_mode_candidates {
+    struct wlr_output_mode** modes;
+    int                      count;
+    int                      index;
+    // what an earlier run settled on, moved right behind the best mode
+    struct wlr_output_mode*  cached;
+};
+
+struct tm_frame_done {
+    // NULL sends to every buffer regardless of its primary output
+    struct wlr_scene_output* scene_output;
+    struct timespec*         now;
+};
+
 struct tm_server {
-    struct wl_display*              wl_display;
-    struct wl_event_loop*           wl_event_loop;
-    struct wl_listener              new_output;
-    struct wl_listener              new_input;
-    struct wl_listener              new_xdg_top_level;
-    struct wl_listener              new_xdg_popup;
-    struct wl_listener              cursor_motion;
-    struct wl_listener              cursor_motion_abs;
-    struct wl_listener              cursor_button;
-    struct wl_listener              cursor_axis;
-    struct wl_listener              cursor_frame;
-    struct wl_listener              request_cursor;
-    struct wl_listener              request_set_selection;
-    struct wl_list                  outputs;
-    struct wl_list                  keyboards;
-    struct wl_list                  top_levels;
-    struct wlr_data_device_manager* dev_manager;
-    struct wlr_compositor*          compositor;
-    struct wlr_subcompositor*       subcompositor;
-    struct wlr_backend*             backend;
-    struct wlr_renderer*            renderer;
-    struct wlr_allocator*           allocator;
-    struct wlr_output_layout*       output_layout;
-    struct wlr_scene*               scene;
-    struct wlr_scene_output_layout* scene_layout;
-    struct wlr_seat*                seat;
-    struct wlr_cursor*              cursor;
-    struct wlr_xcursor_manager*     cursor_mgr;
-    struct wlr_box                  grab_geobox;
-    struct wlr_xdg_shell*           xdg_shell;
-    struct tm_top_level*            grabbed_top_level;
-    enum tm_cursor_mode             cursor_mode;
-    double                          grab_x;
-    double                          grab_y;
-    uint32_t                        resize_edges;
+    struct wl_display*                     wl_display;
+    struct wl_event_loop*                  wl_event_loop;
+    struct wl_listener                     new_output;
+    struct wl_listener                     output_layout_change;
+    struct wl_listener                     new_input;
+    struct wl_listener                     new_xdg_top_level;
+    struct wl_listener                     new_xdg_popup;
+    struct wl_listener                     cursor_motion;
+    struct wl_listener                     cursor_motion_abs;
+    struct wl_listener                     cursor_button;
+    struct wl_listener                     cursor_axis;
+    struct wl_listener                     cursor_frame;
+    struct wl_listener                     request_cursor;
+    struct wl_listener                     request_set_selection;
+    struct wl_event_source*                dump_stats;
+    struct wl_list                         outputs;
+    struct wl_list                         keyboards;
+    struct wl_list                         keymaps;
+    struct xkb_context*                    xkb_context;
+    struct tm_binding_table*               bindings;
+    // table the next key press is looked up in while a chord is in progress
+    struct tm_binding_table*               chord;
+    struct tm_workspace                    workspaces[TM_WORKSPACE_COUNT];
+    struct tm_workspace*                   workspace;
+    uint64_t                               stack_seq;
+    struct wlr_data_device_manager*        dev_manager;
+    struct wlr_compositor*                 compositor;
+    struct wlr_subcompositor*              subcompositor;
+    struct wlr_backend*                    backend;
+    struct wlr_renderer*                   renderer;
+    struct wlr_allocator*                  allocator;
+    struct wlr_output_layout*              output_layout;
+    struct wlr_scene*                      scene;
+    struct wlr_scene_output_layout*        scene_layout;
+    struct wlr_seat*                       seat;
+    struct wlr_cursor*                     cursor;
+    struct wlr_xcursor_manager*            cursor_mgr;
+    struct wlr_box                         grab_geobox;
+    struct wlr_xdg_shell*                  xdg_shell;
+    struct tm_top_level*                   grabbed_top_level;
+    enum tm_cursor_mode                    cursor_mode;
+    bool                                   delay_repaint;
+    // coalesced pointer focus, motion goes to the focused surface right away while the hit test
+    // waits for the next output frame
+    bool                                   coalesce_motion;
+    bool                                   motion_pending;
+    uint32_t                               last_motion_time;
+    double                                 pointer_origin_x;
+    double                                 pointer_origin_y;
+    uint64_t                               motion_events;
+    uint64_t                               hit_tests;
+    enum tm_resize_mode                    resize_mode;
+    bool                                   resize_snapshot;
+    uint64_t                               resize_motion_events;
+    uint64_t                               resize_configures;
+    // top-level buffer commits and how long they took to reach the screen
+    uint64_t                               surface_commits;
+    struct tm_histogram                    commit_to_present;
+    // frame callbacks of fully occluded top-levels come from a slow timer instead of repaints
+    bool                                   occlusion_dirty;
+    int                                    occluded_count;
+    int                                    occluded_frame_interval_ms;
+    bool                                   occluded_frame_armed;
+    struct wl_event_source*                occluded_frame_timer;
+    uint64_t                               occluded_frames_throttled;
+    // new top-levels are tiled instead of floating
+    bool                                   tiling;
+    uint64_t                               layout_configures;
+    struct tm_histogram                    layout_time;
+    // top-levels showing a snapshot until every client caught up with its configure, then all
+    // of them switch to their new buffers together
+    struct wl_list                         transaction;
+    int                                    transaction_waiting;
+    int                                    transaction_timeout_ms;
+    struct wl_event_source*                transaction_timer;
+    int64_t                                transaction_start_ns;
+    uint64_t                               transactions_timed_out;
+    struct tm_histogram                    transaction_time;
+    // open, close and workspace animations, stepped right before the scene commits
+    struct tm_animator                     animator;
+    int64_t                                animation_ns;
+    struct wl_list                         closing;
+    struct tm_histogram                    animation_time;
+    // outputs with a configuration waiting are committed together from an idle callback
+    struct wl_event_source*                output_configure_idle;
+    uint64_t                               output_configures;
+    uint64_t                               output_mode_fallbacks;
+    uint64_t                               output_configure_failures;
+    // fullscreen clients asking for it through tearing-control-v1 get async page flips
+    bool                                   allow_tearing;
+    struct wlr_tearing_control_manager_v1* tearing_control;
+    // feedback is sent by wlroots from the outputs' present events for the surfaces the scene
+    // sampled in that frame
+    struct wlr_presentation*               presentation;
+    // surface commits queued for a refresh cycle, either the one after the previous buffer was
+    // presented or the first one past a target time. wlroots holds them back and releases them
+    // from the same present events
+    struct wlr_fifo_manager_v1*            fifo;
+    // NULL when the renderer can't import dmabufs, clients are left with shm
+    struct wlr_linux_dmabuf_v1*            linux_dmabuf;
+    struct wlr_commit_timing_manager_v1*   commit_timing;
+    double                                 grab_x;
+    double                                 grab_y;
+    uint32_t                               resize_edges;
 };
 
 struct tm_output {
-    struct wl_listener destroy;
-    struct wl_listener frame;
-    struct wl_listener request_state;
-    struct wl_list     link;
-    struct wlr_output* wlr_output;
-    struct tm_server*  server;
-    struct timespec    last_frame;
+    struct wl_listener           destroy;
+    struct wl_listener           frame;
+    struct wl_listener           request_state;
+    struct wl_listener           present;
+    struct wl_list               link;
+    struct wlr_output*           wlr_output;
+    struct tm_server*            server;
+    // layout box minus reserved space, only recomputed when the layout or mode changes
+    struct wlr_box               usable_area;
+    struct timespec              last_frame;
+    // start of the last scene commit, buffers committed before it are in the frame presented next
+    int64_t                      repaint_start_ns;
+    // only set while frames arrive back to back, so idle gaps don't count as intervals
+    bool                         last_frame_committed;
+    struct tm_histogram          frame_interval;
+    struct tm_histogram          commit_time;
+    uint64_t                     missed_frames;
+    // delayed repaint state, the commit is pushed towards the next vblank by a timer
+    struct wl_event_source*      repaint_timer;
+    int64_t                      render_times_ns[TM_RENDER_TIME_SAMPLES];
+    int                          render_time_index;
+    int                          repaint_backoff;
+    // applied together with the other outputs' by the next output_configure
+    struct wlr_output_state      pending;
+    bool                         configure_pending;
+    // switched on and off with the frames. a switch the backend turned down isn't asked for
+    // again until the next modeset or until the policy wants the other state
+    enum tm_adaptive_sync_policy adaptive_sync_policy;
+    bool                         adaptive_sync_rejected;
+    bool                         adaptive_sync_rejected_enable;
+    // the last frame was an async page flip, and how many flips the backend turned down
+    bool                         tearing;
+    uint64_t                     tearing_frames;
+    uint64_t                     tearing_fallbacks;
+    // present events, and how many of them came with a hardware timestamp or were scanned out
+    uint64_t                     presented_frames;
+    uint64_t                     discarded_frames;
+    uint64_t                     hw_clock_frames;
+    uint64_t                     zero_copy_frames;
 };
 
 struct tm_top_level {
@@ -91,12 +339,53 @@ struct tm_top_level {
     struct wl_listener       request_maximize;
     struct wl_listener       request_fullscreen;
     struct tm_server*        server;
+    struct tm_workspace*     workspace;
+    struct wl_list           popups;
+    // cells of the workspace grid covered by index_box, empty while unmapped
+    struct tm_grid_entry*    grid_entries;
+    int                      grid_entry_count;
+    int                      grid_entry_capacity;
+    struct wlr_box           index_box;
+    // bumped whenever the top-level is raised, higher is closer to the top of the scene
+    uint64_t                 stack_seq;
+    // latest interactive resize target not sent yet, and the serial of the one in flight
+    bool                     resize_pending;
+    struct wlr_box           resize_box;
+    uint32_t                 resize_serial;
+    // the last client buffers scaled to the pointer's geometry while the client renders the size
+    // asked for, the live tree is disabled meanwhile
+    struct tm_snapshot       resize_snapshot;
+    // earliest buffer commit not presented yet, 0 when there is none
+    int64_t                  commit_ns;
+    // every buffer is behind opaque parts of top-levels stacked above
+    bool                     occluded;
+    // fullscreen_output is only compared, never dereferenced, it may be gone while unmapped
+    bool                     fullscreen;
+    struct wlr_output*       fullscreen_output;
+    struct wlr_box           fullscreen_box;
+    struct wlr_scene_rect*   fullscreen_background;
+    // maximized_output is only compared, like fullscreen_output
+    bool                     maximized;
+    struct wlr_output*       maximized_output;
+    struct wlr_box           maximized_box;
+    // node position and size to go back to once neither maximized nor fullscreen
+    struct wlr_box           saved_box;
+    // leaf in the workspace layout, NULL while floating
+    struct tm_layout_node*   tile;
+    // copy of the buffers shown when a transaction took the top-level in, the live tree is
+    // disabled meanwhile. transaction_link is only used while there is a snapshot
+    struct wlr_scene_tree*   snapshot;
+    struct wl_list           transaction_link;
+    uint32_t                 transaction_serial;
+    bool                     transaction_ready;
 };
 
 struct tm_popup {
     struct wl_listener    commit;
     struct wl_listener    destroy;
+    struct wl_list        link;
     struct wlr_xdg_popup* xdg_popup;
+    struct tm_top_level*  top_level;
 };
 
 struct tm_keyboard {
@@ -105,13 +394,59 @@ struct tm_keyboard {
     struct wl_listener   destroy;
     struct wl_list       link;
     struct wlr_keyboard* wlr_keyboard;
+    struct tm_keymap*    keymap;
     struct tm_server*    server;
 };
 
+static_assert(TM_BINDING_MODIFIER_MASK ==
+                  (WLR_MODIFIER_SHIFT | WLR_MODIFIER_CTRL | WLR_MODIFIER_ALT | WLR_MODIFIER_LOGO),
+              "binding modifiers must match wlroots keyboard modifiers");
+
 static void server_new_output(struct wl_listener* listener, void* data);
 static void output_destroy(struct wl_listener* listener, void* data);
 static void output_request_state(struct wl_listener* listener, void* data);
+static void output_schedule_configure(struct tm_output* output);
+static void output_configure(void* data);
+static bool output_rank_modes(struct wlr_output*         wlr_output,
+                              struct tm_mode_candidates* candidates);
+static bool mode_ranks_before(const struct wlr_output_mode* a,
+                              const struct wlr_output_mode* b,
+                              const struct wlr_output_mode* preferred);
+static bool output_mode_cache_path(struct wlr_output* wlr_output,
+                                   char*              path,
+                                   size_t             size,
+                                   char*              identity,
+                                   size_t             identity_size);
+static bool output_load_mode(struct wlr_output* wlr_output, int* width, int* height, int* refresh);
+static void output_save_mode(struct wlr_output* wlr_output, const struct wlr_output_mode* mode);
+static void output_layout_change(struct wl_listener* listener, void* data);
+static bool output_update_usable_area(struct tm_output* output);
 static void output_frame(struct wl_listener* listener, void* data);
+static void output_present(struct wl_listener* listener, void* data);
+static int  output_repaint_timer(void* data);
+static void output_repaint(struct tm_output* output);
+static bool output_adaptive_sync_pending(struct tm_output* output, bool* enable);
+static bool output_tearing_allowed(struct tm_output* output);
+static void output_commit_state(struct tm_output*        output,
+                                struct wlr_scene_output* scene_output,
+                                bool                     adaptive_sync_change,
+                                bool                     adaptive_sync);
+static enum tm_adaptive_sync_policy adaptive_sync_policy_from_env(const char* output_name);
+
+static void    output_send_frame_done(struct tm_output*        output,
+                                      struct wlr_scene_output* scene_output,
+                                      struct timespec*         now);
+static void    frame_done_buffer(struct wlr_scene_buffer* buffer, int sx, int sy, void* data);
+static int     occluded_frame_timer(void* data);
+static void    update_occlusion(struct tm_server* server);
+static void    occlusion_add_buffer(struct wlr_scene_buffer* buffer, int sx, int sy, void* data);
+static int64_t output_refresh_ns(struct tm_output* output);
+static int64_t output_render_estimate_ns(struct tm_output* output);
+
+static int     server_dump_stats(int signal_number, void* data);
+static int64_t timespec_to_ns(const struct timespec* ts);
+static int     env_int(const char* name, int fallback);
+static int64_t monotonic_ns(void);
 
 static void server_new_xdg_top_level(struct wl_listener* listener, void* data);
 static void xdg_top_level_map(struct wl_listener* listener, void* data);
@@ -142,12 +477,66 @@ static void keyboard_handle_key(struct wl_listener* listener, void* data);
 static void keyboard_handle_destroy(struct wl_listener* listener, void* data);
 
 static void focus_top_level(struct tm_top_level* top_level, struct wlr_surface* surface);
+static void focus_workspace_top(struct tm_server* server);
+static void switch_workspace(struct tm_server* server, struct tm_workspace* workspace);
+static void workspace_slide(struct tm_server*    server,
+                            struct tm_workspace* from,
+                            struct tm_workspace* to);
+static void move_to_workspace(struct tm_top_level* top_level, struct tm_workspace* workspace);
+static void set_fullscreen(struct tm_top_level* top_level,
+                           bool                 fullscreen,
+                           struct wlr_output*   output);
+static void fullscreen_place(struct tm_top_level* top_level);
+static void fullscreen_clear(struct tm_top_level* top_level);
+static void set_maximized(struct tm_top_level* top_level, bool maximized);
+static void maximize_apply(struct tm_top_level* top_level, struct tm_output* output);
+static void top_level_save_box(struct tm_top_level* top_level);
+static struct wlr_output* top_level_output(struct tm_top_level* top_level);
+static struct tm_output*  top_level_tm_output(struct tm_top_level* top_level);
+static bool stacked_above(const struct tm_top_level* a, const struct tm_top_level* b);
+static struct tm_top_level* focused_top_level(struct tm_server* server);
+static void                 tile_insert(struct tm_top_level* top_level);
+static void                 tile_remove(struct tm_top_level* top_level);
+static void                 tile_place(struct tm_top_level* top_level);
+static void workspace_arrange(struct tm_server* server, struct tm_workspace* workspace);
+static void workspace_update_output(struct tm_server* server, struct tm_workspace* workspace);
+static void transaction_hold(struct tm_top_level* top_level, int width, int height);
+static void transaction_drop(struct tm_top_level* top_level);
+static void transaction_try_apply(struct tm_server* server);
+static void transaction_apply(struct tm_server* server);
+static int  transaction_timeout(void* data);
+static void snapshot_buffer(struct wlr_scene_buffer* buffer, int sx, int sy, void* data);
+static void surface_frame_done(struct wlr_surface* surface, int sx, int sy, void* data);
 static void reset_cursor_mode(struct tm_server* server);
 static void
 begin_interactive(struct tm_top_level* toplevel, enum tm_cursor_mode mode, uint32_t edges);
 static void process_cursor_motion(struct tm_server* server, uint32_t time);
+static void process_pointer_focus(struct tm_server* server, uint32_t time, bool send_motion);
+static void flush_pointer_focus(struct tm_server* server);
 static void process_cursor_move(struct tm_server* server);
 static void process_cursor_resize(struct tm_server* server);
+static void flush_resize(struct tm_top_level* top_level);
+static bool resize_in_flight(struct tm_top_level* top_level);
+static void resize_snapshot_update(struct tm_top_level* top_level, bool new_buffer);
+static void resize_snapshot_take(struct tm_top_level* top_level);
+static void resize_snapshot_drop(struct tm_top_level* top_level);
+static void snapshot_add(struct tm_snapshot* snapshot, struct wlr_scene_node* node, int x, int y);
+static void snapshot_scale(struct tm_snapshot* snapshot, const struct wlr_box* to);
+static enum tm_resize_mode resize_mode_from_env(void);
+static void                animate(struct tm_server*                server,
+                                   void*                            target,
+                                   enum tm_animation_kind           kind,
+                                   enum tm_easing                   easing,
+                                   const struct tm_animation_state* from,
+                                   const struct tm_animation_state* to);
+static void                animation_apply(const struct tm_animation*       animation,
+                                           const struct tm_animation_state* state,
+                                           bool                             done,
+                                           void*                            data);
+static void                animation_step(struct tm_server* server);
+static void                tree_set_opacity(struct wlr_scene_node* node, float opacity);
+static void                closing_start(struct tm_top_level* top_level);
+static void                closing_destroy(struct tm_closing* closing);
 
 static struct tm_top_level* desktop_top_level_at(struct tm_server*    server,
                                                  double               lx,
@@ -155,23 +544,101 @@ static struct tm_top_level* desktop_top_level_at(struct tm_server*    server,
                                                  struct wlr_surface** surface,
                                                  double*              sx,
                                                  double*              sy);
+static struct tm_top_level* scene_top_level_at(struct wlr_scene_node* root,
+                                               double                 lx,
+                                               double                 ly,
+                                               struct wlr_surface**   surface,
+                                               double*                sx,
+                                               double*                sy);
+static void                 index_update(struct tm_top_level* top_level);
+static void                 index_remove(struct tm_top_level* top_level);
+static void                 index_add_surface_box(struct wlr_box*        box,
+                                                  struct wlr_scene_tree* tree,
+                                                  struct wlr_surface*    surface);
+static void                 index_add_box(struct wlr_box* box, const struct wlr_box* extents);
+static struct wl_list*      index_bucket(struct tm_workspace* workspace, int cell_x, int cell_y);
 static void server_new_keyboard(struct tm_server* server, struct wlr_input_device* device);
+static struct tm_keymap*  server_keymap(struct tm_server* server);
+static int64_t            keymap_data_stamp(struct tm_server* server);
+static struct xkb_keymap* keymap_load_cache(struct tm_server* server,
+                                            const char*       path,
+                                            const char*       key);
+static void               keymap_save_cache(struct xkb_keymap* keymap,
+                                            const char*        path,
+                                            const char*        key);
+static bool               cache_path(char*       path,
+                                     size_t      size,
+                                     const char* prefix,
+                                     const char* key,
+                                     const char* extension);
 static void server_new_pointer(struct tm_server* server, struct wlr_input_device* device);
-static bool handle_keybinding(struct tm_server* server, xkb_keysym_t sym);
-
-int main() {
+static bool handle_keybinding(struct tm_server*   server,
+                              uint32_t            modifiers,
+                              const xkb_keysym_t* level0_syms,
+                              int                 level0_count,
+                              const xkb_keysym_t* syms,
+                              int                 count,
+                              bool                release);
+static const struct tm_binding* find_binding(const struct tm_binding_table* table,
+                                             uint32_t                       modifiers,
+                                             const xkb_keysym_t*            syms,
+                                             int                            count,
+                                             bool                           release);
+static bool                     is_modifier_sym(xkb_keysym_t sym);
+static void run_binding(struct tm_server* server, const struct tm_binding* binding);
+static void load_bindings(struct tm_server* server);
+static void spawn_command(const char* command);
+
+int tm_server_run(const struct tm_server_hooks* hooks) {
+
+    struct tm_server server = {0};
+    // TM_DELAY_REPAINT=0 commits as soon as the frame event fires, otherwise the repaint waits
+    // for its deadline rounded down to whole milliseconds, see output_frame
+    server.delay_repaint = env_int("TM_DELAY_REPAINT", 1) != 0;
+    // TM_COALESCE_MOTION=1 resolves pointer focus once per output frame
+    server.coalesce_motion = env_int("TM_COALESCE_MOTION", 0) != 0;
+    // TM_RESIZE_MODE=event|ack|frame paces interactive resize configures
+    server.resize_mode = resize_mode_from_env();
+    // TM_RESIZE_SNAPSHOT=0 shows only what the client drew during interactive resize
+    server.resize_snapshot = env_int("TM_RESIZE_SNAPSHOT", 1) != 0;
+    // TM_TEARING=0 ignores tearing-control-v1 hints and always waits for vblank
+    server.allow_tearing = env_int("TM_TEARING", 1) != 0;
+    // TM_OCCLUDED_FRAME_RATE=hz for frame callbacks of fully covered windows, 0 stops them
+    int occluded_rate                 = env_int("TM_OCCLUDED_FRAME_RATE", 1);
+    server.occluded_frame_interval_ms = occluded_rate > 0 ? 1000 / occluded_rate : 0;
+    // TM_TILING=1 tiles new windows, see tile_insert
+    server.tiling = env_int("TM_TILING", 0) != 0;
+    // TM_TRANSACTION_TIMEOUT=ms for clients to catch up with a layout change, 0 applies at once
+    server.transaction_timeout_ms = env_int("TM_TRANSACTION_TIMEOUT", 200);
+    // TM_ANIMATION_MS=ms for window open, close and workspace switch animations, 0 disables them
+    server.animation_ns = (int64_t)env_int("TM_ANIMATION_MS", 150) * 1000000;
 
-    struct tm_server server;
     server.wl_display    = wl_display_create();
     server.wl_event_loop = wl_display_get_event_loop(server.wl_display);
-    server.backend       = wlr_backend_autocreate(server.wl_event_loop, NULL);
-    server.renderer      = wlr_renderer_autocreate(server.backend);
+    if (hooks != NULL && hooks->create_backend != NULL) {
+        if (!hooks->create_backend(hooks->data, server.wl_event_loop, &server.backend,
+                                   &server.renderer)) {
+            return 1;
+        }
+    } else {
+        server.backend  = wlr_backend_autocreate(server.wl_event_loop, NULL);
+        server.renderer = wlr_renderer_autocreate(server.backend);
+    }
 
     assert(server.wl_display && server.backend && server.renderer);
 
-    if (!wlr_renderer_init_wl_display(server.renderer, server.wl_display)) {
+    if (!wlr_renderer_init_wl_shm(server.renderer, server.wl_display)) {
         return 1;
     }
+    // created here instead of by wlr_renderer_init_wl_display so the scene can send per-surface
+    // feedback, see below
+    if (wlr_renderer_get_texture_formats(server.renderer, WLR_BUFFER_CAP_DMABUF) != NULL) {
+        server.linux_dmabuf =
+            wlr_linux_dmabuf_v1_create_with_renderer(server.wl_display, 4, server.renderer);
+    }
+    if (server.linux_dmabuf == NULL) {
+        fprintf(stderr, "linux-dmabuf unavailable, clients can only share shm buffers\n");
+    }
 
     server.allocator     = wlr_allocator_autocreate(server.backend, server.renderer);
     server.compositor    = wlr_compositor_create(server.wl_display, 5, server.renderer);
@@ -180,13 +647,36 @@ int main() {
     server.output_layout = wlr_output_layout_create(server.wl_display);
 
     wl_list_init(&server.outputs);
-    server.new_output.notify = server_new_output;
+    server.new_output.notify           = server_new_output;
+    server.output_layout_change.notify = output_layout_change;
     wl_signal_add(&server.backend->events.new_output, &server.new_output);
+    wl_signal_add(&server.output_layout->events.change, &server.output_layout_change);
 
     server.scene        = wlr_scene_create();
     server.scene_layout = wlr_scene_attach_output_layout(server.scene, server.output_layout);
+    // a surface whose buffer could go straight to an output's primary plane, which in practice is
+    // a fullscreen top-level, gets a scanout tranche with that plane's formats and modifiers ahead
+    // of the render ones. the scene updates it whenever that changes, so going fullscreen, leaving
+    // it or being covered switches the client between scanout and composited buffers
+    if (server.linux_dmabuf != NULL) {
+        wlr_scene_set_linux_dmabuf_v1(server.scene, server.linux_dmabuf);
+    }
 
-    wl_list_init(&server.top_levels);
+    for (int i = 0; i < TM_WORKSPACE_COUNT; i++) {
+        struct tm_workspace* workspace = &server.workspaces[i];
+        workspace->tree                = wlr_scene_tree_create(&server.scene->tree);
+        workspace->layer_normal        = wlr_scene_tree_create(workspace->tree);
+        workspace->layer_fullscreen    = wlr_scene_tree_create(workspace->tree);
+        wl_list_init(&workspace->top_levels);
+        for (int j = 0; j < TM_GRID_BUCKETS; j++) {
+            wl_list_init(&workspace->grid[j]);
+        }
+        if (!tm_layout_init(&workspace->layout)) {
+            return 1;
+        }
+        wlr_scene_node_set_enabled(&workspace->tree->node, i == 0);
+    }
+    server.workspace = &server.workspaces[0];
     server.xdg_shell                = wlr_xdg_shell_create(server.wl_display, 3);
     server.new_xdg_top_level.notify = server_new_xdg_top_level;
     server.new_xdg_popup.notify     = server_new_xdg_popup;
@@ -194,6 +684,21 @@ int main() {
     wl_signal_add(&server.xdg_shell->events.new_toplevel, &server.new_xdg_top_level);
     wl_signal_add(&server.xdg_shell->events.new_popup, &server.new_xdg_popup);
 
+    server.tearing_control = wlr_tearing_control_manager_v1_create(server.wl_display, 1);
+    server.presentation    = wlr_presentation_create(server.wl_display, server.backend, 2);
+    server.fifo            = wlr_fifo_manager_v1_create(server.wl_display, 1);
+    server.commit_timing   = wlr_commit_timing_manager_v1_create(server.wl_display, 1);
+
+    // screen capture through ext-image-copy-capture and the older wlr-screencopy. both hook the
+    // commits of the outputs' scene, so a client waiting for a frame gets one only once the
+    // scene actually repainted something, along with the damage since its last frame. a static
+    // desktop schedules nothing and copies nothing. TM_CAPTURE=0 leaves the globals out
+    if (env_int("TM_CAPTURE", 1) != 0) {
+        wlr_ext_image_copy_capture_manager_v1_create(server.wl_display, 1);
+        wlr_ext_output_image_capture_source_manager_v1_create(server.wl_display, 1);
+        wlr_screencopy_manager_v1_create(server.wl_display);
+    }
+
     server.cursor = wlr_cursor_create();
     wlr_cursor_attach_output_layout(server.cursor, server.output_layout);
 
@@ -214,6 +719,11 @@ int main() {
     server.seat = wlr_seat_create(server.wl_display, "seat0");
 
     wl_list_init(&server.keyboards);
+    wl_list_init(&server.keymaps);
+    server.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    // compile or map the default keymap up front so the first keyboard attaches for free
+    server_keymap(&server);
+    load_bindings(&server);
     server.new_input.notify             = server_new_input;
     server.request_cursor.notify        = seat_request_cursor;
     server.request_set_selection.notify = seat_request_set_selection;
@@ -222,6 +732,17 @@ int main() {
     wl_signal_add(&server.seat->events.request_set_cursor, &server.request_cursor);
     wl_signal_add(&server.seat->events.request_set_selection, &server.request_set_selection);
 
+    server.occluded_frame_timer =
+        wl_event_loop_add_timer(server.wl_event_loop, occluded_frame_timer, &server);
+    wl_list_init(&server.transaction);
+    wl_list_init(&server.closing);
+    server.transaction_timer =
+        wl_event_loop_add_timer(server.wl_event_loop, transaction_timeout, &server);
+
+    // kill -USR1 dumps per-output frame timing
+    server.dump_stats =
+        wl_event_loop_add_signal(server.wl_event_loop, SIGUSR1, server_dump_stats, &server);
+
     const char* socket = wl_display_add_socket_auto(server.wl_display);
     if (!socket) {
         wlr_backend_destroy(server.backend);
@@ -235,17 +756,52 @@ int main() {
     }
     setenv("WAYLAND_DISPLAY", socket, true);
 
-    printf("Running Wayland compositor on WAYLAND_DISPLAY=%s\n", socket);
+    if (hooks != NULL && hooks->started != NULL) {
+        hooks->started(hooks->data, &server, server.wl_display, server.backend, socket);
+    } else {
+        printf("Running Wayland compositor on WAYLAND_DISPLAY=%s\n", socket);
+    }
     wl_display_run(server.wl_display);
 
+    if (hooks != NULL && hooks->stopped != NULL) {
+        hooks->stopped(hooks->data);
+    }
+    wl_event_source_remove(server.dump_stats);
+    wl_event_source_remove(server.occluded_frame_timer);
+    wl_event_source_remove(server.transaction_timer);
+    if (server.output_configure_idle != NULL) {
+        wl_event_source_remove(server.output_configure_idle);
+    }
     wl_display_destroy_clients(server.wl_display);
     wlr_scene_node_destroy(&server.scene->tree.node);
+    // their trees went with the scene
+    struct tm_closing* closing;
+    struct tm_closing* closing_tmp;
+    wl_list_for_each_safe(closing, closing_tmp, &server.closing, link) {
+        wl_list_remove(&closing->link);
+        free(closing->snapshot.buffers);
+        free(closing);
+    }
     wlr_xcursor_manager_destroy(server.cursor_mgr);
     wlr_cursor_destroy(server.cursor);
     wlr_allocator_destroy(server.allocator);
     wlr_renderer_destroy(server.renderer);
     wlr_backend_destroy(server.backend);
     wl_display_destroy(server.wl_display);
+
+    struct tm_keymap* keymap;
+    struct tm_keymap* tmp;
+    wl_list_for_each_safe(keymap, tmp, &server.keymaps, link) {
+        wl_list_remove(&keymap->link);
+        xkb_keymap_unref(keymap->keymap);
+        free(keymap->names);
+        free(keymap);
+    }
+    xkb_context_unref(server.xkb_context);
+    tm_binding_table_destroy(server.bindings);
+    for (int i = 0; i < TM_WORKSPACE_COUNT; i++) {
+        tm_layout_finish(&server.workspaces[i].layout);
+    }
     return 0;
 }
 
@@ -257,28 +813,22 @@ static void server_new_output(struct wl_listener* listener, void* data) {
 
     wlr_output_init_render(wlr_output, server->allocator, server->renderer);
 
-    struct wlr_output_state state;
-    wlr_output_state_init(&state);
-    wlr_output_state_set_enabled(&state, true);
-
-    struct wlr_output_mode* mode = wlr_output_preferred_mode(wlr_output);
-    if (mode != NULL) {
-        wlr_output_state_set_mode(&state, mode);
-    }
-
-    wlr_output_commit_state(wlr_output, &state);
-    wlr_output_state_finish(&state);
-
     struct tm_output* output     = calloc(1, sizeof(struct tm_output));
     output->server               = server;
     output->wlr_output           = wlr_output;
     output->frame.notify         = output_frame;
     output->request_state.notify = output_request_state;
     output->destroy.notify       = output_destroy;
+    output->present.notify       = output_present;
+    output->adaptive_sync_policy = adaptive_sync_policy_from_env(wlr_output->name);
+    wlr_output->data             = output;
+    output->repaint_timer =
+        wl_event_loop_add_timer(server->wl_event_loop, output_repaint_timer, output);
 
     wl_signal_add(&wlr_output->events.frame, &output->frame);
     wl_signal_add(&wlr_output->events.request_state, &output->request_state);
     wl_signal_add(&wlr_output->events.destroy, &output->destroy);
+    wl_signal_add(&wlr_output->events.present, &output->present);
 
     wl_list_insert(&server->outputs, &output->link);
 
@@ -286,189 +836,1147 @@ static void server_new_output(struct wl_listener* listener, void* data) {
         wlr_output_layout_add_auto(server->output_layout, wlr_output);
     struct wlr_scene_output* scene_output = wlr_scene_output_create(server->scene, wlr_output);
     wlr_scene_output_layout_add_output(server->scene_layout, layout_output, scene_output);
+
+    // enabled along with every other output appearing before the loop goes idle, so plugging
+    // in a dock is a single modeset
+    wlr_output_state_init(&output->pending);
+    wlr_output_state_set_enabled(&output->pending, true);
+    output_schedule_configure(output);
 }
 
 static void output_frame(struct wl_listener* listener, [[maybe_unused]] void* data) {
     struct tm_output* output = wl_container_of(listener, output, frame);
+    struct tm_server* server = output->server;
+
+    flush_pointer_focus(server);
+    if (server->resize_mode == TM_RESIZE_FRAME && server->cursor_mode == TM_CURSOR_RESIZE &&
+        server->grabbed_top_level->resize_pending) {
+        flush_resize(server->grabbed_top_level);
+    }
 
-    struct wlr_scene* scene = output->server->scene;
+    struct timespec frame_start;
+    clock_gettime(CLOCK_MONOTONIC, &frame_start);
 
-    struct wlr_scene_output* scene_output = wlr_scene_get_scene_output(scene, output->wlr_output);
-    wlr_scene_output_commit(scene_output, NULL);
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    wlr_scene_output_send_frame_done(scene_output, &now);
-}
+    int64_t refresh_ns = output_refresh_ns(output);
 
-static void output_request_state(struct wl_listener* listener, void* data) {
-    struct tm_output* output = wl_container_of(listener, output, request_state);
-    const struct wlr_output_event_request_state* event = data;
-    wlr_output_commit_state(output->wlr_output, event->state);
+    if (output->last_frame_committed) {
+        int64_t interval_ns = timespec_to_ns(&frame_start) - timespec_to_ns(&output->last_frame);
+        tm_histogram_add(&output->frame_interval, interval_ns);
+        if (interval_ns > refresh_ns + refresh_ns / 2) {
+            output->missed_frames++;
+        }
+    }
+
+    // the frame event only lines up with a vblank when the previous frame was committed,
+    // otherwise it was scheduled and there is no deadline to aim for. async flips don't wait for
+    // one either, the point is to draw and flip the moment the client's buffer is there
+    bool can_delay = server->delay_repaint && output->last_frame_committed &&
+                     output->repaint_backoff == 0 && !output->tearing;
+    output->last_frame = frame_start;
+
+    if (output->repaint_backoff > 0) {
+        output->repaint_backoff--;
+    }
+
+    // event loop timers only count whole milliseconds. the wait is measured from now and rounded
+    // down, so the repaint fires up to a millisecond early rather than after its deadline
+    int64_t deadline_ns = timespec_to_ns(&frame_start) + refresh_ns -
+                          output_render_estimate_ns(output) - TM_REPAINT_MARGIN_NS;
+    int     delay_ms    = (deadline_ns - monotonic_ns()) / 1000000;
+    if (!can_delay || delay_ms <= 0) {
+        output_repaint(output);
+        return;
+    }
+    wl_event_source_timer_update(output->repaint_timer, delay_ms);
 }
 
-static void output_destroy(struct wl_listener* listener, [[maybe_unused]] void* data) {
-    struct tm_output* output = wl_container_of(listener, output, destroy);
-    wl_list_remove(&output->link);
-    wl_list_remove(&output->destroy.link);
-    wl_list_remove(&output->frame.link);
-    free(output);
+static int output_repaint_timer(void* data) {
+    output_repaint(data);
+    return 0;
 }
 
-static void server_new_xdg_top_level(struct wl_listener* listener, void* data) {
-    struct tm_server* server = wl_container_of(listener, server, new_xdg_top_level);
+static void output_repaint(struct tm_output* output) {
+    struct wlr_scene*        scene        = output->server->scene;
+    struct wlr_scene_output* scene_output = wlr_scene_get_scene_output(scene, output->wlr_output);
 
-    struct wlr_xdg_toplevel* xdg_top_level = data;
+    struct timespec repaint_start;
+    clock_gettime(CLOCK_MONOTONIC, &repaint_start);
+    output->repaint_start_ns = timespec_to_ns(&repaint_start);
 
-    struct tm_top_level* top_level = calloc(1, sizeof(struct tm_top_level));
-    top_level->server              = server;
-    top_level->xdg_top_level       = xdg_top_level;
-    top_level->scene_tree =
-        wlr_scene_xdg_surface_create(&top_level->server->scene->tree, xdg_top_level->base);
-    top_level->scene_tree->node.data = top_level;
-    xdg_top_level->base->data        = top_level->scene_tree;
+    // counted in the commit time, so delayed repaints leave room for it
+    if (output->server->animator.active > 0) {
+        animation_step(output->server);
+    }
 
-    // listen to shell window events
-    top_level->map.notify                = xdg_top_level_map;
-    top_level->unmap.notify              = xdg_top_level_unmap;
-    top_level->commit.notify             = xdg_top_level_commit;
-    top_level->destroy.notify            = xdg_top_level_destroy;
-    top_level->request_move.notify       = xdg_top_level_request_move;
-    top_level->request_resize.notify     = xdg_top_level_request_resize;
-    top_level->request_maximize.notify   = xdg_top_level_request_maximize;
-    top_level->request_fullscreen.notify = xdg_top_level_request_fullscreen;
+    bool needs_frame = wlr_scene_output_needs_frame(scene_output);
+    bool adaptive_sync;
+    bool adaptive_sync_change = output_adaptive_sync_pending(output, &adaptive_sync);
+    output->tearing           = needs_frame && output_tearing_allowed(output);
+    if (adaptive_sync_change || output->tearing) {
+        needs_frame = true;
+        output_commit_state(output, scene_output, adaptive_sync_change, adaptive_sync);
+    } else {
+        wlr_scene_output_commit(scene_output, NULL);
+    }
 
-    wl_signal_add(&xdg_top_level->base->surface->events.map, &top_level->map);
-    wl_signal_add(&xdg_top_level->base->surface->events.unmap, &top_level->unmap);
-    wl_signal_add(&xdg_top_level->base->surface->events.commit, &top_level->commit);
-    wl_signal_add(&xdg_top_level->base->surface->events.destroy, &top_level->destroy);
-    wl_signal_add(&xdg_top_level->events.request_move, &top_level->request_move);
-    wl_signal_add(&xdg_top_level->events.request_resize, &top_level->request_resize);
-    wl_signal_add(&xdg_top_level->events.request_maximize, &top_level->request_maximize);
-    wl_signal_add(&xdg_top_level->events.request_fullscreen, &top_level->request_fullscreen);
-}
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-// surface is ready to display
-static void xdg_top_level_map(struct wl_listener* listener, [[maybe_unused]] void* data) {
-    struct tm_top_level* top_level = wl_container_of(listener, top_level, map);
-    wl_list_insert(&top_level->server->top_levels, &top_level->link);
-    focus_top_level(top_level, top_level->xdg_top_level->base->surface);
+    if (needs_frame) {
+        int64_t commit_ns = timespec_to_ns(&now) - timespec_to_ns(&repaint_start);
+        tm_histogram_add(&output->commit_time, commit_ns);
+
+        output->render_times_ns[output->render_time_index] = commit_ns;
+        output->render_time_index = (output->render_time_index + 1) % TM_RENDER_TIME_SAMPLES;
+
+        int64_t deadline_ns = timespec_to_ns(&output->last_frame) + output_refresh_ns(output);
+        if (timespec_to_ns(&now) > deadline_ns) {
+            // commit immediately on frame for a while before trying to delay again. the missed
+            // vblank itself is counted by output_frame from the interval it leaves
+            output->repaint_backoff = TM_REPAINT_BACKOFF_FRAMES;
+        }
+    }
+    output->last_frame_committed = needs_frame;
+
+    output_send_frame_done(output, scene_output, &now);
 }
 
-// surface should no longer be shown
-static void xdg_top_level_unmap(struct wl_listener* listener, [[maybe_unused]] void* data) {
-    struct tm_top_level* top_level = wl_container_of(listener, top_level, unmap);
-    if (top_level == top_level->server->grabbed_top_level) {
-        reset_cursor_mode(top_level->server);
+// whether the next commit has to turn adaptive sync on or off, and which of the two
+static bool output_adaptive_sync_pending(struct tm_output* output, bool* enable) {
+    struct wlr_output* wlr_output = output->wlr_output;
+    switch (output->adaptive_sync_policy) {
+    case TM_ADAPTIVE_SYNC_OFF:
+        *enable = false;
+        break;
+    case TM_ADAPTIVE_SYNC_ALWAYS:
+        *enable = true;
+        break;
+    case TM_ADAPTIVE_SYNC_FULLSCREEN: {
+        struct tm_top_level* focused = focused_top_level(output->server);
+        *enable =
+            focused != NULL && focused->fullscreen && focused->fullscreen_output == wlr_output;
+        break;
     }
-    wl_list_remove(&top_level->link);
+    }
+
+    // either direction can be turned down, retrying every frame would repaint forever
+    if (output->adaptive_sync_rejected) {
+        if (*enable == output->adaptive_sync_rejected_enable) {
+            return false;
+        }
+        output->adaptive_sync_rejected = false;
+    }
+
+    bool enabled = wlr_output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
+    if (*enable && !wlr_output->adaptive_sync_supported) {
+        return false;
+    }
+    return *enable != enabled;
 }
 
-// new surface state is committed
-static void xdg_top_level_commit(struct wl_listener* listener, [[maybe_unused]] void* data) {
-    struct tm_top_level* top_level = wl_container_of(listener, top_level, commit);
+// whether the fullscreen top-level on the output asked for async page flips
+static bool output_tearing_allowed(struct tm_output* output) {
+    struct tm_server* server = output->server;
+    if (!server->allow_tearing) {
+        return false;
+    }
 
-    if (top_level->xdg_top_level->base->initial_commit) {
-        wlr_xdg_toplevel_set_size(top_level->xdg_top_level, 0, 0);
+    struct tm_top_level* top_level;
+    wl_list_for_each(top_level, &server->workspace->top_levels, link) {
+        if (top_level->fullscreen && top_level->fullscreen_output == output->wlr_output) {
+            return wlr_tearing_control_manager_v1_surface_hint_from_surface(
+                       server->tearing_control, top_level->xdg_top_level->base->surface) ==
+                   WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC;
+        }
     }
+    return false;
 }
 
-static void xdg_top_level_destroy(struct wl_listener* listener, [[maybe_unused]] void* data) {
-    struct tm_top_level* top_level = wl_container_of(listener, top_level, destroy);
+// what wlr_scene_output_commit does, for frames carrying more than the scene: an adaptive sync
+// switch, committed even when nothing was damaged, or an async page flip. whatever the backend
+// turns down is left out and the frame goes out without it
+static void output_commit_state(struct tm_output*        output,
+                                struct wlr_scene_output* scene_output,
+                                bool                     adaptive_sync_change,
+                                bool                     adaptive_sync) {
+    struct wlr_output*      wlr_output = output->wlr_output;
+    struct wlr_output_state state;
+    wlr_output_state_init(&state);
+    if (adaptive_sync_change) {
+        wlr_output_state_set_adaptive_sync_enabled(&state, adaptive_sync);
+    }
+    if (!wlr_scene_output_build_state(scene_output, &state, NULL)) {
+        wlr_output_state_finish(&state);
+        return;
+    }
 
-    wl_list_remove(&top_level->map.link);
-    wl_list_remove(&top_level->unmap.link);
-    wl_list_remove(&top_level->commit.link);
-    wl_list_remove(&top_level->destroy.link);
-    wl_list_remove(&top_level->request_move.link);
-    wl_list_remove(&top_level->request_resize.link);
-    wl_list_remove(&top_level->request_maximize.link);
-    wl_list_remove(&top_level->request_fullscreen.link);
+    // only tested when it switches, which is rare
+    bool rejected = adaptive_sync_change && !wlr_output_test_state(wlr_output, &state);
+    if (rejected) {
+        state.committed &= ~WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED;
+        output->adaptive_sync_rejected        = true;
+        output->adaptive_sync_rejected_enable = adaptive_sync;
+    }
 
-    free(top_level);
-}
+    // an async flip can fail for reasons that change from frame to frame, a cursor plane update
+    // for one, so it is simply retried as a regular flip instead of being tested every frame
+    state.tearing_page_flip = output->tearing;
+    bool committed          = wlr_output_commit_state(wlr_output, &state);
+    if (!committed && state.tearing_page_flip) {
+        state.tearing_page_flip = false;
+        output->tearing         = false;
+        output->tearing_fallbacks++;
+        committed = wlr_output_commit_state(wlr_output, &state);
+    }
+    if (committed && output->tearing) {
+        output->tearing_frames++;
+    }
+    wlr_output_state_finish(&state);
 
-static void xdg_top_level_request_move(struct wl_listener* listener, [[maybe_unused]] void* data) {
-    struct tm_top_level* top_level = wl_container_of(listener, top_level, request_move);
-    begin_interactive(top_level, TM_CURSOR_MOVE, 0);
+    if (rejected) {
+        wlr_log(WLR_ERROR, "output %s: turning adaptive sync %s was rejected by the backend",
+                wlr_output->name, adaptive_sync ? "on" : "off");
+    } else if (adaptive_sync_change && committed) {
+        wlr_log(WLR_INFO, "output %s: adaptive sync %s", wlr_output->name,
+                adaptive_sync ? "enabled" : "disabled");
+    }
 }
 
-static void xdg_top_level_request_resize(struct wl_listener* listener, void* data) {
-    struct wlr_xdg_toplevel_resize_event* event = data;
-    struct tm_top_level* top_level = wl_container_of(listener, top_level, request_resize);
-    begin_interactive(top_level, TM_CURSOR_RESIZE, event->edges);
+// TM_VRR is the policy of every output, optionally with overrides for outputs by name such as
+// "fullscreen,DP-1=always"
+static enum tm_adaptive_sync_policy adaptive_sync_policy_from_env(const char* output_name) {
+    const char* value = getenv("TM_VRR");
+    char*       copy  = value != NULL ? strdup(value) : NULL;
+    if (copy == NULL) {
+        return TM_ADAPTIVE_SYNC_OFF;
+    }
+
+    enum tm_adaptive_sync_policy policy = TM_ADAPTIVE_SYNC_OFF;
+    bool                         named  = false;
+    char*                        save   = NULL;
+    char*                        item   = strtok_r(copy, ",", &save);
+    for (; item != NULL; item = strtok_r(NULL, ",", &save)) {
+        const char* name   = NULL;
+        char*       equals = strchr(item, '=');
+        if (equals != NULL) {
+            *equals = '\0';
+            name    = item;
+            item    = equals + 1;
+        }
+        if ((name != NULL && strcmp(name, output_name) != 0) || (name == NULL && named)) {
+            continue;
+        }
+
+        if (strcmp(item, "off") == 0) {
+            policy = TM_ADAPTIVE_SYNC_OFF;
+        } else if (strcmp(item, "always") == 0) {
+            policy = TM_ADAPTIVE_SYNC_ALWAYS;
+        } else if (strcmp(item, "fullscreen") == 0) {
+            policy = TM_ADAPTIVE_SYNC_FULLSCREEN;
+        } else {
+            fprintf(stderr, "unknown TM_VRR policy %s, using off\n", item);
+            continue;
+        }
+        named = name != NULL;
+    }
+    free(copy);
+    return policy;
 }
 
-static void xdg_top_level_request_maximize(struct wl_listener*    listener,
-                                           [[maybe_unused]] void* data) {
-    struct tm_top_level* top_level = wl_container_of(listener, top_level, request_maximize);
-    if (top_level->xdg_top_level->base->initialized) {
-        wlr_xdg_surface_schedule_configure(top_level->xdg_top_level->base);
+// replaces wlr_scene_output_send_frame_done, which would also pace clients nobody can see at the
+// output's refresh rate
+static void output_send_frame_done(struct tm_output*        output,
+                                   struct wlr_scene_output* scene_output,
+                                   struct timespec*         now) {
+    struct tm_server* server = output->server;
+    update_occlusion(server);
+
+    struct tm_frame_done done = {.scene_output = scene_output, .now = now};
+    struct tm_top_level* top_level;
+    wl_list_for_each(top_level, &server->workspace->top_levels, link) {
+        if (top_level->occluded) {
+            server->occluded_frames_throttled++;
+            continue;
+        }
+        // the scene skips a live tree hidden behind its resize snapshot
+        if (top_level->resize_snapshot.tree != NULL) {
+            wlr_xdg_surface_for_each_surface(top_level->xdg_top_level->base, surface_frame_done,
+                                             now);
+            continue;
+        }
+        wlr_scene_node_for_each_buffer(&top_level->scene_tree->node, frame_done_buffer, &done);
+    }
+    // workspaces sliding out stay enabled and on screen until their animation is done, see
+    // animation_apply. their occlusion isn't tracked, but that only lasts as long as the slide
+    for (int i = 0; i < TM_WORKSPACE_COUNT; i++) {
+        struct tm_workspace* workspace = &server->workspaces[i];
+        if (workspace == server->workspace || !workspace->tree->node.enabled) {
+            continue;
+        }
+        wl_list_for_each(top_level, &workspace->top_levels, link) {
+            wlr_scene_node_for_each_buffer(&top_level->scene_tree->node, frame_done_buffer,
+                                           &done);
+        }
+    }
+
+    // the scene skips the disabled trees of transaction participants, but their clients may
+    // wait for a callback before drawing the buffer the transaction needs
+    wl_list_for_each(top_level, &server->transaction, transaction_link) {
+        if (!top_level->transaction_ready) {
+            wlr_xdg_surface_for_each_surface(top_level->xdg_top_level->base, surface_frame_done,
+                                             now);
+        }
     }
 }
 
-static void xdg_top_level_request_fullscreen(struct wl_listener*    listener,
-                                             [[maybe_unused]] void* data) {
-    struct tm_top_level* toplevel = wl_container_of(listener, toplevel, request_fullscreen);
-    if (toplevel->xdg_top_level->base->initialized) {
-        wlr_xdg_surface_schedule_configure(toplevel->xdg_top_level->base);
+static void frame_done_buffer(struct wlr_scene_buffer* buffer,
+                              [[maybe_unused]] int     sx,
+                              [[maybe_unused]] int     sy,
+                              void*                    data) {
+    struct tm_frame_done* done = data;
+    if (done->scene_output == NULL || buffer->primary_output == done->scene_output) {
+        wlr_scene_buffer_send_frame_done(buffer, done->now);
     }
 }
 
-static void server_new_xdg_popup([[maybe_unused]] struct wl_listener* listener, void* data) {
-    struct wlr_xdg_popup*   xdg_popup = data;
-    struct wlr_xdg_surface* parent    = wlr_xdg_surface_try_from_wlr_surface(xdg_popup->parent);
-    assert(parent);
+static int occluded_frame_timer(void* data) {
+    struct tm_server* server = data;
+    update_occlusion(server);
 
-    struct wlr_scene_tree* parent_tree = parent->data;
-    xdg_popup->base->data              = wlr_scene_xdg_surface_create(parent_tree, xdg_popup->base);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    struct tm_popup* popup = calloc(1, sizeof(struct tm_popup));
-    popup->xdg_popup       = xdg_popup;
-    popup->commit.notify   = xdg_popup_commit;
-    popup->destroy.notify  = xdg_popup_destroy;
+    // occluded buffers may have no primary output at all, so they get no output filter
+    struct tm_frame_done done = {.scene_output = NULL, .now = &now};
+    struct tm_top_level* top_level;
+    wl_list_for_each(top_level, &server->workspace->top_levels, link) {
+        if (top_level->occluded) {
+            wlr_scene_node_for_each_buffer(&top_level->scene_tree->node, frame_done_buffer, &done);
+        }
+    }
 
-    wl_signal_add(&xdg_popup->base->surface->events.commit, &popup->commit);
-    wl_signal_add(&xdg_popup->events.destroy, &popup->destroy);
+    server->occluded_frame_armed = server->occluded_count > 0;
+    if (server->occluded_frame_armed) {
+        wl_event_source_timer_update(server->occluded_frame_timer,
+                                     server->occluded_frame_interval_ms);
+    }
+    return 0;
 }
 
-static void xdg_popup_commit(struct wl_listener* listener, [[maybe_unused]] void* data) {
-    struct tm_popup* popup = wl_container_of(listener, popup, commit);
-    if (popup->xdg_popup->base->initial_commit) {
-        wlr_xdg_surface_schedule_configure(popup->xdg_popup->base);
+// walks top-levels front to back, subtracting the opaque area seen so far from each one. only
+// runs when stacking or surface state changed since the last pass
+static void update_occlusion(struct tm_server* server) {
+    if (!server->occlusion_dirty) {
+        return;
+    }
+    server->occlusion_dirty = false;
+
+    pixman_region32_t covered;
+    pixman_region32_init(&covered);
+
+    int                  occluded = 0;
+    struct tm_top_level* top_level;
+    // fullscreen top-levels are above the rest whatever their place in the focus order
+    for (int pass = 0; pass < 2; pass++) {
+        wl_list_for_each(top_level, &server->workspace->top_levels, link) {
+            if (top_level->fullscreen != (pass == 0)) {
+                continue;
+            }
+            struct tm_occlusion occlusion;
+            pixman_region32_init(&occlusion.area);
+            pixman_region32_init(&occlusion.opaque);
+
+            wlr_scene_node_for_each_buffer(&top_level->scene_tree->node, occlusion_add_buffer,
+                                           &occlusion);
+            bool has_area = pixman_region32_not_empty(&occlusion.area);
+            pixman_region32_subtract(&occlusion.area, &occlusion.area, &covered);
+            top_level->occluded = has_area && !pixman_region32_not_empty(&occlusion.area);
+            occluded += top_level->occluded;
+
+            pixman_region32_union(&covered, &covered, &occlusion.opaque);
+            if (top_level->fullscreen) {
+                struct wlr_box* box = &top_level->fullscreen_box;
+                pixman_region32_union_rect(&covered, &covered, box->x, box->y, box->width,
+                                           box->height);
+            }
+            pixman_region32_fini(&occlusion.area);
+            pixman_region32_fini(&occlusion.opaque);
+        }
+    }
+    pixman_region32_fini(&covered);
+
+    server->occluded_count = occluded;
+    if (occluded > 0 && !server->occluded_frame_armed && server->occluded_frame_interval_ms > 0) {
+        server->occluded_frame_armed = true;
+        wl_event_source_timer_update(server->occluded_frame_timer,
+                                     server->occluded_frame_interval_ms);
     }
 }
 
-static void xdg_popup_destroy(struct wl_listener* listener, [[maybe_unused]] void* data) {
-    struct tm_popup* popup = wl_container_of(listener, popup, destroy);
+static void occlusion_add_buffer(struct wlr_scene_buffer* buffer, int sx, int sy, void* data) {
+    struct tm_occlusion* occlusion = data;
 
-    wl_list_remove(&popup->commit.link);
-    wl_list_remove(&popup->destroy.link);
+    int width  = buffer->dst_width;
+    int height = buffer->dst_height;
+    if ((width == 0 || height == 0) && buffer->buffer != NULL) {
+        width  = buffer->buffer->width;
+        height = buffer->buffer->height;
+    }
+    pixman_region32_union_rect(&occlusion->area, &occlusion->area, sx, sy, width, height);
 
-    free(popup);
+    // opaque_region only covers what the client declared opaque
+    if (buffer->opacity < 1.0f) {
+        return;
+    }
+    pixman_region32_t opaque;
+    pixman_region32_init(&opaque);
+    pixman_region32_copy(&opaque, &buffer->opaque_region);
+    pixman_region32_translate(&opaque, sx, sy);
+    pixman_region32_union(&occlusion->opaque, &occlusion->opaque, &opaque);
+    pixman_region32_fini(&opaque);
 }
 
-// pointer emits a relatve pointer motion event like a delta
-static void server_cursor_motion(struct wl_listener* listener, void* data) {
-    struct tm_server*                server = wl_container_of(listener, server, cursor_motion);
-    struct wlr_pointer_motion_event* event  = data;
+static void output_present(struct wl_listener* listener, void* data) {
+    struct tm_output*                       output = wl_container_of(listener, output, present);
+    const struct wlr_output_event_present* event  = data;
+    if (!event->presented) {
+        output->discarded_frames++;
+        return;
+    }
+    output->presented_frames++;
+    output->hw_clock_frames  += (event->flags & WLR_OUTPUT_PRESENT_HW_CLOCK) != 0;
+    output->zero_copy_frames += (event->flags & WLR_OUTPUT_PRESENT_ZERO_COPY) != 0;
+
+    int64_t              present_ns = timespec_to_ns(&event->when);
+    struct tm_top_level* top_level;
+    wl_list_for_each(top_level, &output->server->workspace->top_levels, link) {
+        // commits that arrived during or after the repaint show up in a later frame
+        if (top_level->commit_ns == 0 || top_level->commit_ns > output->repaint_start_ns) {
+            continue;
+        }
 
-    wlr_cursor_move(server->cursor, &event->pointer->base, event->delta_x, event->delta_y);
-    process_cursor_motion(server, event->time_msec);
+        struct wlr_surface*        surface = top_level->xdg_top_level->base->surface;
+        struct wlr_surface_output* surface_output;
+        wl_list_for_each(surface_output, &surface->current_outputs, link) {
+            if (surface_output->output == output->wlr_output) {
+                tm_histogram_add(&output->server->commit_to_present,
+                              present_ns - top_level->commit_ns);
+                top_level->commit_ns = 0;
+                break;
+            }
+        }
+    }
 }
 
-static void server_cursor_motion_absolute(struct wl_listener* listener, void* data) {
-    struct tm_server* server = wl_container_of(listener, server, cursor_motion_abs);
-    struct wlr_pointer_motion_absolute_event* event = data;
-
-    wlr_cursor_warp_absolute(server->cursor, &event->pointer->base, event->x, event->y);
-    process_cursor_motion(server, event->time_msec);
+static int64_t output_refresh_ns(struct tm_output* output) {
+    // refresh is in mHz, fall back to 60Hz for backends that don't report one
+    return output->wlr_output->refresh > 0 ? 1000000000000ll / output->wlr_output->refresh
+                                           : 1000000000ll / 60;
 }
 
-// pointer emits a button event
+// worst commit cost over the last few frames, so a single cheap frame doesn't pull the repaint
+// too close to the vblank
+static int64_t output_render_estimate_ns(struct tm_output* output) {
+    int64_t estimate = 0;
+    for (int i = 0; i < TM_RENDER_TIME_SAMPLES; i++) {
+        if (output->render_times_ns[i] > estimate) {
+            estimate = output->render_times_ns[i];
+        }
+    }
+    return estimate;
+}
+
+static int64_t timespec_to_ns(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * 1000000000ll + ts->tv_nsec;
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_to_ns(&now);
+}
+
+static int env_int(const char* name, int fallback) {
+    const char* value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    return atoi(value);
+}
+
+static int server_dump_stats([[maybe_unused]] int signal_number, void* data) {
+    tm_server_dump_stats(data);
+    return 0;
+}
+
+void tm_server_dump_stats(struct tm_server* server) {
+    struct tm_output* output;
+    wl_list_for_each(output, &server->outputs, link) {
+        bool adaptive_sync =
+            output->wlr_output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
+        printf("output %s: missed=%" PRIu64 " render_estimate=%.3fms adaptive_sync=%s%s "
+               "async_flips=%" PRIu64 " fallbacks=%" PRIu64 "\n",
+               output->wlr_output->name, output->missed_frames,
+               output_render_estimate_ns(output) / 1e6, adaptive_sync ? "on" : "off",
+               output->adaptive_sync_rejected ? " (rejected)" : "", output->tearing_frames,
+               output->tearing_fallbacks);
+        printf("  presented=%" PRIu64 " discarded=%" PRIu64 " hw_clock=%" PRIu64
+               " zero_copy=%" PRIu64 "\n",
+               output->presented_frames, output->discarded_frames, output->hw_clock_frames,
+               output->zero_copy_frames);
+        tm_histogram_print(&output->frame_interval, "frame interval", true);
+        tm_histogram_print(&output->commit_time, "scene commit", true);
+    }
+    printf("pointer: motion=%" PRIu64 " hit_tests=%" PRIu64 "\n", server->motion_events,
+           server->hit_tests);
+    printf("resize: motion=%" PRIu64 " configures=%" PRIu64 "\n", server->resize_motion_events,
+           server->resize_configures);
+    printf("surfaces: commits=%" PRIu64 " occluded=%d throttled_frames=%" PRIu64 "\n",
+           server->surface_commits, server->occluded_count, server->occluded_frames_throttled);
+    tm_histogram_print(&server->commit_to_present, "commit to present", true);
+    printf("transactions: timed_out=%" PRIu64 "\n", server->transactions_timed_out);
+    tm_histogram_print(&server->transaction_time, "transaction", true);
+    printf("output configures: commits=%" PRIu64 " mode_fallbacks=%" PRIu64
+           " rejected=%" PRIu64 "\n",
+           server->output_configures, server->output_mode_fallbacks,
+           server->output_configure_failures);
+    printf("animations: active=%d closing=%d\n", server->animator.active,
+           wl_list_length(&server->closing));
+    tm_histogram_print(&server->animation_time, "animation step", true);
+    if (server->tiling) {
+        printf("layout: configures=%" PRIu64 "\n", server->layout_configures);
+        tm_histogram_print(&server->layout_time, "layout pass", true);
+    }
+    fflush(stdout);
+}
+
+uint64_t tm_server_frame_count(struct tm_server* server) {
+    uint64_t          frames = 0;
+    struct tm_output* output;
+    wl_list_for_each(output, &server->outputs, link) {
+        frames += output->commit_time.count;
+    }
+    return frames;
+}
+
+static void output_request_state(struct wl_listener* listener, void* data) {
+    struct tm_output* output = wl_container_of(listener, output, request_state);
+    const struct wlr_output_event_request_state* event = data;
+    // nested backends ask for this when their window is resized, it waits for the batch too
+    wlr_output_state_copy(&output->pending, event->state);
+    output_schedule_configure(output);
+}
+
+static void output_schedule_configure(struct tm_output* output) {
+    struct tm_server* server  = output->server;
+    output->configure_pending = true;
+    if (server->output_configure_idle == NULL) {
+        server->output_configure_idle =
+            wl_event_loop_add_idle(server->wl_event_loop, output_configure, server);
+    }
+}
+
+// commits every pending output configuration with one backend commit, so the outputs are
+// modeset together instead of one after the other. the whole set is tried with a test-only
+// commit first, and outputs being enabled without a mode asked for take turns stepping down
+// their ranked modes until the backend accepts it
+static void output_configure(void* data) {
+    struct tm_server* server      = data;
+    server->output_configure_idle = NULL;
+
+    int               count = 0;
+    struct tm_output* output;
+    wl_list_for_each(output, &server->outputs, link) {
+        count += output->configure_pending;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    struct wlr_backend_output_state* states =
+        calloc(count, sizeof(struct wlr_backend_output_state));
+    // empty for outputs whose mode was asked for or stays as it is
+    struct tm_mode_candidates* candidates = calloc(count, sizeof(struct tm_mode_candidates));
+    if (states == NULL || candidates == NULL) {
+        free(states);
+        free(candidates);
+        return;
+    }
+
+    int i = 0;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (!output->configure_pending) {
+            continue;
+        }
+        struct wlr_backend_output_state* state = &states[i];
+        state->output                          = output->wlr_output;
+        wlr_output_state_init(&state->base);
+        wlr_output_state_copy(&state->base, &output->pending);
+        if (!(state->base.committed & WLR_OUTPUT_STATE_ENABLED)) {
+            wlr_output_state_set_enabled(&state->base, true);
+        }
+
+        if (state->base.enabled && !output->wlr_output->enabled &&
+            !(state->base.committed & WLR_OUTPUT_STATE_MODE) &&
+            output_rank_modes(output->wlr_output, &candidates[i])) {
+            wlr_output_state_set_mode(&state->base, candidates[i].modes[0]);
+        }
+        i++;
+    }
+
+    // preparing allocates the swapchains the new modes need and runs the test-only commit,
+    // nothing reaches the screen before wlr_backend_commit
+    struct wlr_output_swapchain_manager swapchains;
+    wlr_output_swapchain_manager_init(&swapchains, server->backend);
+    bool ok = wlr_output_swapchain_manager_prepare(&swapchains, states, count);
+    // one mode down per output per round, so a link that can't carry every output at its best
+    // costs each of them a little instead of the first one everything. an output that runs out
+    // of modes keeps the last one it tried, usually the cheapest
+    bool stepped = true;
+    while (!ok && stepped) {
+        stepped = false;
+        for (i = 0; !ok && i < count; i++) {
+            struct tm_mode_candidates* modes = &candidates[i];
+            if (modes->index + 1 >= modes->count) {
+                continue;
+            }
+            wlr_output_state_set_mode(&states[i].base, modes->modes[++modes->index]);
+            server->output_mode_fallbacks++;
+            stepped = true;
+            ok      = wlr_output_swapchain_manager_prepare(&swapchains, states, count);
+        }
+    }
+
+    // the first frame of every enabled output goes out with the modeset
+    for (i = 0; ok && i < count; i++) {
+        if (!states[i].base.enabled) {
+            continue;
+        }
+        struct wlr_scene_output* scene_output =
+            wlr_scene_get_scene_output(server->scene, states[i].output);
+        struct wlr_scene_output_state_options options = {
+            .swapchain = wlr_output_swapchain_manager_get_swapchain(&swapchains, states[i].output),
+        };
+        ok = wlr_scene_output_build_state(scene_output, &states[i].base, &options);
+    }
+    if (ok) {
+        ok = wlr_backend_commit(server->backend, states, count);
+    }
+
+    if (ok) {
+        wlr_output_swapchain_manager_apply(&swapchains);
+        server->output_configures++;
+        // the next start tries the mode that worked right after the best one and skips the
+        // search, a fallback is only remembered until the best mode fits again
+        for (i = 0; i < count; i++) {
+            struct tm_output* configured       = states[i].output->data;
+            configured->adaptive_sync_rejected = false;
+
+            struct tm_mode_candidates* modes = &candidates[i];
+            if (modes->count > 0 && modes->modes[modes->index] != modes->cached) {
+                output_save_mode(states[i].output, modes->modes[modes->index]);
+            }
+        }
+    } else {
+        server->output_configure_failures++;
+        fprintf(stderr, "output configuration for %d outputs was rejected\n", count);
+        for (i = 0; i < count; i++) {
+            if (states[i].base.enabled && !states[i].output->enabled) {
+                fprintf(stderr, "output %s stays disabled\n", states[i].output->name);
+            }
+        }
+    }
+    wlr_output_swapchain_manager_finish(&swapchains);
+
+    // a rejected configuration isn't retried, the next hotplug or request starts over
+    for (i = 0; i < count; i++) {
+        wlr_output_state_finish(&states[i].base);
+        free(candidates[i].modes);
+    }
+    wl_list_for_each(output, &server->outputs, link) {
+        if (output->configure_pending) {
+            wlr_output_state_finish(&output->pending);
+            wlr_output_state_init(&output->pending);
+            output->configure_pending = false;
+        }
+    }
+    free(states);
+    free(candidates);
+}
+
+// fills candidates with every mode of the output, best first. false if it has none to choose from
+static bool output_rank_modes(struct wlr_output*         wlr_output,
+                              struct tm_mode_candidates* candidates) {
+    struct wlr_output_mode* preferred = wlr_output_preferred_mode(wlr_output);
+    int                     count     = wl_list_length(&wlr_output->modes);
+    if (preferred == NULL || count == 0) {
+        return false;
+    }
+    candidates->modes = calloc(count, sizeof(struct wlr_output_mode*));
+    if (candidates->modes == NULL) {
+        return false;
+    }
+
+    // insertion sort, outputs have a few dozen modes at most
+    struct wlr_output_mode* mode;
+    wl_list_for_each(mode, &wlr_output->modes, link) {
+        int i = candidates->count++;
+        while (i > 0 && mode_ranks_before(mode, candidates->modes[i - 1], preferred)) {
+            candidates->modes[i] = candidates->modes[i - 1];
+            i--;
+        }
+        candidates->modes[i] = mode;
+    }
+
+    // the cached mode may be a fallback another output's bandwidth forced on an earlier run, so
+    // the best mode still gets the first test and the cached one saves the walk down if it fails
+    int width, height, refresh;
+    if (!output_load_mode(wlr_output, &width, &height, &refresh)) {
+        return true;
+    }
+    for (int i = 0; i < candidates->count; i++) {
+        mode = candidates->modes[i];
+        if (mode->width == width && mode->height == height && mode->refresh == refresh) {
+            if (i > 1) {
+                memmove(&candidates->modes[2], &candidates->modes[1], (i - 1) * sizeof(mode));
+                candidates->modes[1] = mode;
+            }
+            candidates->cached = mode;
+            break;
+        }
+    }
+    return true;
+}
+
+// the preferred mode's resolution first since it is the panel's native one, then more pixels,
+// then a higher refresh rate, which lowers latency at no cost when the link can carry it
+static bool mode_ranks_before(const struct wlr_output_mode* a,
+                              const struct wlr_output_mode* b,
+                              const struct wlr_output_mode* preferred) {
+    bool a_native = a->width == preferred->width && a->height == preferred->height;
+    bool b_native = b->width == preferred->width && b->height == preferred->height;
+    if (a_native != b_native) {
+        return a_native;
+    }
+    int64_t a_pixels = (int64_t)a->width * a->height;
+    int64_t b_pixels = (int64_t)b->width * b->height;
+    if (a_pixels != b_pixels) {
+        return a_pixels > b_pixels;
+    }
+    return a->refresh > b->refresh;
+}
+
+// keyed by the monitor rather than the connector, so the choice follows it between ports
+static bool output_mode_cache_path(struct wlr_output* wlr_output,
+                                   char*              path,
+                                   size_t             size,
+                                   char*              identity,
+                                   size_t             identity_size) {
+    snprintf(identity, identity_size, "%s %s %s", wlr_output->make ? wlr_output->make : "",
+             wlr_output->model ? wlr_output->model : "",
+             wlr_output->serial ? wlr_output->serial : "");
+    return cache_path(path, size, "output", identity, "mode");
+}
+
+static bool output_load_mode(struct wlr_output* wlr_output, int* width, int* height, int* refresh) {
+    char path[4096];
+    char identity[256];
+    if (!output_mode_cache_path(wlr_output, path, sizeof(path), identity, sizeof(identity))) {
+        return false;
+    }
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    size_t identity_len = strlen(identity);
+    char   line[sizeof(identity) + 1];
+    bool   ok           = false;
+    if (fgets(line, sizeof(line), file) != NULL && strncmp(line, identity, identity_len) == 0 &&
+        line[identity_len] == '\n') {
+        ok = fscanf(file, "%dx%d@%d", width, height, refresh) == 3;
+    }
+    fclose(file);
+    return ok;
+}
+
+static void output_save_mode(struct wlr_output* wlr_output, const struct wlr_output_mode* mode) {
+    char path[4096];
+    char identity[256];
+    if (!output_mode_cache_path(wlr_output, path, sizeof(path), identity, sizeof(identity))) {
+        return;
+    }
+
+    // written next to the final path and renamed, like the keymap cache
+    char tmp_path[sizeof(path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+
+    FILE* file = fopen(tmp_path, "w");
+    if (file != NULL) {
+        bool ok = fprintf(file, "%s\n%dx%d@%d\n", identity, mode->width, mode->height,
+                          mode->refresh) > 0;
+        ok      = fclose(file) == 0 && ok;
+        if (!ok || rename(tmp_path, path) != 0) {
+            unlink(tmp_path);
+        }
+    }
+}
+
+// fires for outputs added, removed or moved and for mode, scale and transform changes
+static void output_layout_change(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_server* server = wl_container_of(listener, server, output_layout_change);
+
+    struct tm_output* output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (!output_update_usable_area(output)) {
+            continue;
+        }
+
+        for (int i = 0; i < TM_WORKSPACE_COUNT; i++) {
+            struct tm_top_level* top_level;
+            wl_list_for_each(top_level, &server->workspaces[i].top_levels, link) {
+                if (top_level->fullscreen && top_level->fullscreen_output == output->wlr_output) {
+                    set_fullscreen(top_level, true, output->wlr_output);
+                } else if (top_level->maximized &&
+                           top_level->maximized_output == output->wlr_output) {
+                    maximize_apply(top_level, output);
+                }
+            }
+        }
+    }
+
+    // hidden workspaces catch up when shown
+    if (server->tiling) {
+        for (int i = 0; i < TM_WORKSPACE_COUNT; i++) {
+            workspace_update_output(server, &server->workspaces[i]);
+        }
+        workspace_arrange(server, server->workspace);
+    }
+}
+
+// returns whether the usable area changed. nothing reserves space at the edges yet, so it is
+// the output's layout box
+static bool output_update_usable_area(struct tm_output* output) {
+    struct wlr_box box = {0};
+    wlr_output_layout_get_box(output->server->output_layout, output->wlr_output, &box);
+
+    // an output on its way out has already left the layout, keep what it had
+    struct wlr_box* old = &output->usable_area;
+    if (wlr_box_empty(&box) || (box.x == old->x && box.y == old->y &&
+                                box.width == old->width && box.height == old->height)) {
+        return false;
+    }
+    output->usable_area = box;
+    return true;
+}
+
+static void output_destroy(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_output* output = wl_container_of(listener, output, destroy);
+
+    for (int i = 0; i < TM_WORKSPACE_COUNT; i++) {
+        // the layout change that follows moves the tiles to another output
+        if (output->server->workspaces[i].output == output) {
+            output->server->workspaces[i].output = NULL;
+        }
+        struct tm_top_level* top_level;
+        wl_list_for_each(top_level, &output->server->workspaces[i].top_levels, link) {
+            if (top_level->fullscreen && top_level->fullscreen_output == output->wlr_output) {
+                set_fullscreen(top_level, false, NULL);
+            }
+            if (top_level->maximized && top_level->maximized_output == output->wlr_output) {
+                set_maximized(top_level, false);
+            }
+        }
+    }
+    wl_event_source_remove(output->repaint_timer);
+    wlr_output_state_finish(&output->pending);
+    wl_list_remove(&output->link);
+    wl_list_remove(&output->destroy.link);
+    wl_list_remove(&output->frame.link);
+    wl_list_remove(&output->request_state.link);
+    wl_list_remove(&output->present.link);
+    free(output);
+}
+
+static void server_new_xdg_top_level(struct wl_listener* listener, void* data) {
+    struct tm_server* server = wl_container_of(listener, server, new_xdg_top_level);
+
+    struct wlr_xdg_toplevel* xdg_top_level = data;
+
+    struct tm_top_level* top_level = calloc(1, sizeof(struct tm_top_level));
+    top_level->server              = server;
+    top_level->workspace           = server->workspace;
+    top_level->xdg_top_level       = xdg_top_level;
+    top_level->scene_tree =
+        wlr_scene_xdg_surface_create(server->workspace->layer_normal, xdg_top_level->base);
+    top_level->scene_tree->node.data = top_level;
+    xdg_top_level->base->data        = top_level->scene_tree;
+    wl_list_init(&top_level->popups);
+
+    // listen to shell window events
+    top_level->map.notify                = xdg_top_level_map;
+    top_level->unmap.notify              = xdg_top_level_unmap;
+    top_level->commit.notify             = xdg_top_level_commit;
+    top_level->destroy.notify            = xdg_top_level_destroy;
+    top_level->request_move.notify       = xdg_top_level_request_move;
+    top_level->request_resize.notify     = xdg_top_level_request_resize;
+    top_level->request_maximize.notify   = xdg_top_level_request_maximize;
+    top_level->request_fullscreen.notify = xdg_top_level_request_fullscreen;
+
+    wl_signal_add(&xdg_top_level->base->surface->events.map, &top_level->map);
+    wl_signal_add(&xdg_top_level->base->surface->events.unmap, &top_level->unmap);
+    wl_signal_add(&xdg_top_level->base->surface->events.commit, &top_level->commit);
+    wl_signal_add(&xdg_top_level->base->surface->events.destroy, &top_level->destroy);
+    wl_signal_add(&xdg_top_level->events.request_move, &top_level->request_move);
+    wl_signal_add(&xdg_top_level->events.request_resize, &top_level->request_resize);
+    wl_signal_add(&xdg_top_level->events.request_maximize, &top_level->request_maximize);
+    wl_signal_add(&xdg_top_level->events.request_fullscreen, &top_level->request_fullscreen);
+}
+
+// surface is ready to display
+static void xdg_top_level_map(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_top_level* top_level = wl_container_of(listener, top_level, map);
+    wl_list_insert(&top_level->workspace->top_levels, &top_level->link);
+    top_level->stack_seq = ++top_level->server->stack_seq;
+    index_update(top_level);
+    // windows mapping on a workspace switched away from since they were created wait there
+    if (top_level->workspace == top_level->server->workspace) {
+        focus_top_level(top_level, top_level->xdg_top_level->base->surface);
+        struct tm_animation_state from = {.opacity = 0.0};
+        struct tm_animation_state to   = {.opacity = 1.0};
+        animate(top_level->server, top_level, TM_ANIMATE_OPEN, TM_EASE_OUT_CUBIC, &from, &to);
+    }
+}
+
+// surface should no longer be shown
+static void xdg_top_level_unmap(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_top_level* top_level = wl_container_of(listener, top_level, unmap);
+    if (top_level == top_level->server->grabbed_top_level) {
+        reset_cursor_mode(top_level->server);
+    }
+    closing_start(top_level);
+    wl_list_remove(&top_level->link);
+    index_remove(top_level);
+    top_level->commit_ns = 0;
+    if (top_level->tile != NULL) {
+        tile_remove(top_level);
+    }
+    if (top_level->snapshot != NULL) {
+        transaction_drop(top_level);
+        transaction_try_apply(top_level->server);
+    }
+    resize_snapshot_drop(top_level);
+    // the client starts over from its initial commit, which asks again if it still wants to
+    if (top_level->fullscreen || top_level->maximized) {
+        fullscreen_clear(top_level);
+        top_level->maximized        = false;
+        top_level->maximized_output = NULL;
+        wlr_scene_node_set_position(&top_level->scene_tree->node, top_level->saved_box.x,
+                                    top_level->saved_box.y);
+    }
+}
+
+// new surface state is committed
+static void xdg_top_level_commit(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_top_level* top_level = wl_container_of(listener, top_level, commit);
+
+    struct wlr_surface* surface = top_level->xdg_top_level->base->surface;
+
+    if (top_level->xdg_top_level->base->initial_commit) {
+        struct wlr_xdg_toplevel_requested* requested = &top_level->xdg_top_level->requested;
+        // the tile's size goes out with the first configure, so the first buffer already fits
+        if (top_level->server->tiling) {
+            tile_insert(top_level);
+        }
+        if (requested->maximized) {
+            set_maximized(top_level, true);
+        }
+        if (requested->fullscreen) {
+            set_fullscreen(top_level, true, requested->fullscreen_output);
+        } else if (!requested->maximized && top_level->tile == NULL) {
+            wlr_xdg_toplevel_set_size(top_level->xdg_top_level, 0, 0);
+        }
+    }
+    if (surface->mapped) {
+        struct wlr_box* geometry = &top_level->xdg_top_level->base->geometry;
+        if (top_level->fullscreen) {
+            fullscreen_place(top_level);
+        } else if (top_level->maximized) {
+            wlr_scene_node_set_position(&top_level->scene_tree->node,
+                                        top_level->maximized_box.x - geometry->x,
+                                        top_level->maximized_box.y - geometry->y);
+        } else if (top_level->tile != NULL) {
+            wlr_scene_node_set_position(&top_level->scene_tree->node,
+                                        top_level->tile->box.x - geometry->x,
+                                        top_level->tile->box.y - geometry->y);
+        }
+        index_update(top_level);
+        if (top_level->resize_snapshot.tree != NULL &&
+            (surface->current.committed & WLR_SURFACE_STATE_BUFFER)) {
+            resize_snapshot_update(top_level, true);
+        }
+        if (top_level->snapshot != NULL && !top_level->transaction_ready &&
+            (surface->current.committed & WLR_SURFACE_STATE_BUFFER) &&
+            (int32_t)(top_level->xdg_top_level->base->current.configure_serial -
+                      top_level->transaction_serial) >= 0) {
+            top_level->transaction_ready = true;
+            top_level->server->transaction_waiting--;
+            transaction_try_apply(top_level->server);
+        }
+        if (surface->current.committed & WLR_SURFACE_STATE_BUFFER) {
+            top_level->server->surface_commits++;
+            // buffers replaced before being presented count from the first one, hidden
+            // workspaces present nothing
+            if (top_level->commit_ns == 0 && top_level->workspace == top_level->server->workspace) {
+                top_level->commit_ns = monotonic_ns();
+            }
+        }
+    }
+
+    // the client caught up with the last resize configure, send whatever piled up meanwhile
+    if (top_level->resize_pending && top_level->server->resize_mode == TM_RESIZE_ACK &&
+        !resize_in_flight(top_level)) {
+        flush_resize(top_level);
+    }
+}
+
+static void xdg_top_level_destroy(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_top_level* top_level = wl_container_of(listener, top_level, destroy);
+
+    wl_list_remove(&top_level->map.link);
+    wl_list_remove(&top_level->unmap.link);
+    wl_list_remove(&top_level->commit.link);
+    wl_list_remove(&top_level->destroy.link);
+    wl_list_remove(&top_level->request_move.link);
+    wl_list_remove(&top_level->request_resize.link);
+    wl_list_remove(&top_level->request_maximize.link);
+    wl_list_remove(&top_level->request_fullscreen.link);
+    tm_animation_cancel(&top_level->server->animator, top_level);
+    fullscreen_clear(top_level);
+    // destroyed between the initial commit and the first buffer
+    if (top_level->tile != NULL) {
+        tile_remove(top_level);
+    }
+
+    struct tm_popup* popup;
+    struct tm_popup* tmp;
+    wl_list_for_each_safe(popup, tmp, &top_level->popups, link) {
+        popup->top_level = NULL;
+        wl_list_remove(&popup->link);
+        wl_list_init(&popup->link);
+    }
+
+    free(top_level->grid_entries);
+    free(top_level->resize_snapshot.buffers);
+    free(top_level);
+}
+
+static void xdg_top_level_request_move(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_top_level* top_level = wl_container_of(listener, top_level, request_move);
+    begin_interactive(top_level, TM_CURSOR_MOVE, 0);
+}
+
+static void xdg_top_level_request_resize(struct wl_listener* listener, void* data) {
+    struct wlr_xdg_toplevel_resize_event* event = data;
+    struct tm_top_level* top_level = wl_container_of(listener, top_level, request_resize);
+    begin_interactive(top_level, TM_CURSOR_RESIZE, event->edges);
+}
+
+static void xdg_top_level_request_maximize(struct wl_listener*    listener,
+                                           [[maybe_unused]] void* data) {
+    struct tm_top_level* top_level = wl_container_of(listener, top_level, request_maximize);
+    // requests before the initial commit are picked up there
+    if (top_level->xdg_top_level->base->initialized) {
+        set_maximized(top_level, top_level->xdg_top_level->requested.maximized);
+    }
+}
+
+static void xdg_top_level_request_fullscreen(struct wl_listener*    listener,
+                                             [[maybe_unused]] void* data) {
+    struct tm_top_level* toplevel = wl_container_of(listener, toplevel, request_fullscreen);
+    struct wlr_xdg_toplevel_requested* requested = &toplevel->xdg_top_level->requested;
+    // requests before the initial commit are picked up there
+    if (toplevel->xdg_top_level->base->initialized) {
+        set_fullscreen(toplevel, requested->fullscreen, requested->fullscreen_output);
+    }
+}
+
+static void server_new_xdg_popup([[maybe_unused]] struct wl_listener* listener, void* data) {
+    struct wlr_xdg_popup*   xdg_popup = data;
+    struct wlr_xdg_surface* parent    = wlr_xdg_surface_try_from_wlr_surface(xdg_popup->parent);
+    assert(parent);
+
+    struct wlr_scene_tree* parent_tree = parent->data;
+    xdg_popup->base->data              = wlr_scene_xdg_surface_create(parent_tree, xdg_popup->base);
+
+    struct tm_popup* popup = calloc(1, sizeof(struct tm_popup));
+    popup->xdg_popup       = xdg_popup;
+    popup->commit.notify   = xdg_popup_commit;
+    popup->destroy.notify  = xdg_popup_destroy;
+
+    // nested popups hang off their parent popup's tree, the owning top-level is the first
+    // ancestor carrying node data
+    while (parent_tree != NULL && parent_tree->node.data == NULL) {
+        parent_tree = parent_tree->node.parent;
+    }
+    if (parent_tree != NULL) {
+        popup->top_level = parent_tree->node.data;
+        wl_list_insert(&popup->top_level->popups, &popup->link);
+    } else {
+        wl_list_init(&popup->link);
+    }
+
+    wl_signal_add(&xdg_popup->base->surface->events.commit, &popup->commit);
+    wl_signal_add(&xdg_popup->events.destroy, &popup->destroy);
+}
+
+static void xdg_popup_commit(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_popup* popup = wl_container_of(listener, popup, commit);
+    if (popup->xdg_popup->base->initial_commit) {
+        wlr_xdg_surface_schedule_configure(popup->xdg_popup->base);
+    }
+    if (popup->top_level != NULL && popup->top_level->xdg_top_level->base->surface->mapped) {
+        index_update(popup->top_level);
+    }
+}
+
+static void xdg_popup_destroy(struct wl_listener* listener, [[maybe_unused]] void* data) {
+    struct tm_popup* popup = wl_container_of(listener, popup, destroy);
+
+    wl_list_remove(&popup->commit.link);
+    wl_list_remove(&popup->destroy.link);
+    wl_list_remove(&popup->link);
+
+    if (popup->top_level != NULL && popup->top_level->xdg_top_level->base->surface->mapped) {
+        index_update(popup->top_level);
+    }
+
+    free(popup);
+}
+
+// pointer emits a relatve pointer motion event like a delta
+static void server_cursor_motion(struct wl_listener* listener, void* data) {
+    struct tm_server*                server = wl_container_of(listener, server, cursor_motion);
+    struct wlr_pointer_motion_event* event  = data;
+
+    wlr_cursor_move(server->cursor, &event->pointer->base, event->delta_x, event->delta_y);
+    process_cursor_motion(server, event->time_msec);
+}
+
+static void server_cursor_motion_absolute(struct wl_listener* listener, void* data) {
+    struct tm_server* server = wl_container_of(listener, server, cursor_motion_abs);
+    struct wlr_pointer_motion_absolute_event* event = data;
+
+    wlr_cursor_warp_absolute(server->cursor, &event->pointer->base, event->x, event->y);
+    process_cursor_motion(server, event->time_msec);
+}
+
+// pointer emits a button event
 static void server_cursor_button(struct wl_listener* listener, void* data) {
     struct tm_server*                server = wl_container_of(listener, server, cursor_button);
     struct wlr_pointer_button_event* event  = data;
 
+    flush_pointer_focus(server);
     wlr_seat_pointer_notify_button(server->seat, event->time_msec, event->button, event->state);
 
     double               sx, sy;
@@ -489,6 +1997,7 @@ static void server_cursor_axis(struct wl_listener* listener, void* data) {
     struct tm_server*              server = wl_container_of(listener, server, cursor_axis);
     struct wlr_pointer_axis_event* event  = data;
 
+    flush_pointer_focus(server);
     wlr_seat_pointer_notify_axis(server->seat, event->time_msec, event->orientation, event->delta,
                                  event->delta_discrete, event->source, event->relative_direction);
 }
@@ -550,18 +2059,23 @@ static void keyboard_handle_key(struct wl_listener* listener, void* data) {
     struct wlr_keyboard_key_event* event    = data;
     struct wlr_seat*               seat     = server->seat;
 
+    struct xkb_state*   xkb_state = keyboard->wlr_keyboard->xkb_state;
     const xkb_keysym_t* syms;
-
-    uint32_t keycode = event->keycode + 8;
-    int      nsyms   = xkb_state_key_get_syms(keyboard->wlr_keyboard->xkb_state, keycode, &syms);
-
-    bool     handled   = false;
-    uint32_t modifiers = wlr_keyboard_get_modifiers(keyboard->wlr_keyboard);
-    if ((modifiers & WLR_MODIFIER_ALT) && event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-        for (int i = 0; i < nsyms; i++) {
-            handled = handle_keybinding(server, syms[i]);
-        }
-    }
+    const xkb_keysym_t* level0_syms;
+
+    // bindings name the key as printed without Shift, Alt+Shift+1 and not Alt+exclam, so the
+    // level 0 syms are tried before the ones translated through the held modifiers
+    uint32_t           keycode = event->keycode + 8;
+    int                nsyms   = xkb_state_key_get_syms(xkb_state, keycode, &syms);
+    xkb_layout_index_t layout  = xkb_state_key_get_layout(xkb_state, keycode);
+    int                nlevel0 = xkb_keymap_key_get_syms_by_level(keyboard->wlr_keyboard->keymap,
+                                                                  keycode, layout, 0, &level0_syms);
+
+    bool     release = event->state == WL_KEYBOARD_KEY_STATE_RELEASED;
+    uint32_t modifiers =
+        wlr_keyboard_get_modifiers(keyboard->wlr_keyboard) & TM_BINDING_MODIFIER_MASK;
+    bool handled =
+        handle_keybinding(server, modifiers, level0_syms, nlevel0, syms, nsyms, release);
 
     if (!handled) {
         wlr_seat_set_keyboard(seat, keyboard->wlr_keyboard);
@@ -604,11 +2118,22 @@ static void focus_top_level(struct tm_top_level* top_level, struct wlr_surface*
 
     struct wlr_keyboard* keyboard = wlr_seat_get_keyboard(seat);
 
+    // a tile behind others in a stack comes to the front of it
+    if (top_level->tile != NULL) {
+        tm_layout_focus(&top_level->workspace->layout, top_level->tile);
+        workspace_arrange(server, top_level->workspace);
+    }
+
     // move top-level surface to the front
     wlr_scene_node_raise_to_top(&top_level->scene_tree->node);
+    if (top_level->snapshot != NULL) {
+        wlr_scene_node_raise_to_top(&top_level->snapshot->node);
+    }
+    top_level->stack_seq      = ++server->stack_seq;
+    server->occlusion_dirty = true;
     // unlink surface from current position in scene list
     wl_list_remove(&top_level->link);
-    wl_list_insert(&server->top_levels, &top_level->link);
+    wl_list_insert(&top_level->workspace->top_levels, &top_level->link);
     wlr_xdg_toplevel_set_activated(top_level->xdg_top_level, true);
 
     if (keyboard) {
@@ -618,9 +2143,570 @@ static void focus_top_level(struct tm_top_level* top_level, struct wlr_surface*
     }
 }
 
+// focuses the most recently focused window of the active workspace, or nothing if it is empty
+static void focus_workspace_top(struct tm_server* server) {
+    struct tm_workspace* workspace = server->workspace;
+    if (!wl_list_empty(&workspace->top_levels)) {
+        struct tm_top_level* top_level =
+            wl_container_of(workspace->top_levels.next, top_level, link);
+        focus_top_level(top_level, top_level->xdg_top_level->base->surface);
+        return;
+    }
+
+    struct wlr_surface* prev_surface = server->seat->keyboard_state.focused_surface;
+    struct wlr_xdg_toplevel* prev_top_level =
+        prev_surface != NULL ? wlr_xdg_toplevel_try_from_wlr_surface(prev_surface) : NULL;
+    if (prev_top_level != NULL) {
+        wlr_xdg_toplevel_set_activated(prev_top_level, false);
+    }
+    wlr_seat_keyboard_notify_clear_focus(server->seat);
+}
+
+// O(1) in the number of windows, only the two workspace roots change
+static void switch_workspace(struct tm_server* server, struct tm_workspace* workspace) {
+    if (workspace == server->workspace) {
+        return;
+    }
+    if (server->grabbed_top_level != NULL) {
+        reset_cursor_mode(server);
+    }
+
+    // the previous tree stays enabled until it slid out, see animation_apply
+    struct tm_workspace* previous = server->workspace;
+    wlr_scene_node_set_enabled(&workspace->tree->node, true);
+    server->workspace       = workspace;
+    server->occlusion_dirty = true;
+    workspace_arrange(server, workspace);
+
+    focus_workspace_top(server);
+    workspace_slide(server, previous, workspace);
+}
+
+// slides from out and to in over the width of the center output, higher numbers coming in from
+// the right. a switch during a slide carries on from wherever the trees got to
+static void workspace_slide(struct tm_server*    server,
+                            struct tm_workspace* from,
+                            struct tm_workspace* to) {
+    struct wlr_output* center    = wlr_output_layout_get_center_output(server->output_layout);
+    struct tm_output*  output    = center != NULL ? center->data : NULL;
+    int                width     = output != NULL ? output->usable_area.width : 0;
+    double             direction = to > from ? 1.0 : -1.0;
+    int64_t            now       = monotonic_ns();
+
+    struct tm_animation_state out_from = {.x = 0.0};
+    struct tm_animation_state out_to   = {.x = -direction * width};
+    tm_animation_current(&server->animator, from, now, &out_from);
+    animate(server, from, TM_ANIMATE_WORKSPACE, TM_EASE_OUT_CUBIC, &out_from, &out_to);
+
+    struct tm_animation_state in_from = {.x = direction * width};
+    struct tm_animation_state in_to   = {.x = 0.0};
+    tm_animation_current(&server->animator, to, now, &in_from);
+    animate(server, to, TM_ANIMATE_WORKSPACE, TM_EASE_OUT_CUBIC, &in_from, &in_to);
+}
+
+static void move_to_workspace(struct tm_top_level* top_level, struct tm_workspace* workspace) {
+    struct tm_server* server = top_level->server;
+    if (workspace == top_level->workspace) {
+        return;
+    }
+    if (server->grabbed_top_level == top_level) {
+        reset_cursor_mode(server);
+    }
+
+    bool mapped = top_level->xdg_top_level->base->surface->mapped;
+    bool tiled  = top_level->tile != NULL;
+    if (mapped) {
+        wl_list_remove(&top_level->link);
+        index_remove(top_level);
+    }
+    if (tiled) {
+        tile_remove(top_level);
+    }
+    // snapshots stay in the old workspace's tree
+    if (top_level->snapshot != NULL) {
+        transaction_drop(top_level);
+        transaction_try_apply(server);
+    }
+    resize_snapshot_drop(top_level);
+
+    top_level->workspace = workspace;
+    if (top_level->fullscreen) {
+        wlr_scene_node_reparent(&top_level->fullscreen_background->node,
+                                workspace->layer_fullscreen);
+        wlr_scene_node_reparent(&top_level->scene_tree->node, workspace->layer_fullscreen);
+        wlr_scene_node_place_below(&top_level->fullscreen_background->node,
+                                   &top_level->scene_tree->node);
+    } else {
+        wlr_scene_node_reparent(&top_level->scene_tree->node, workspace->layer_normal);
+    }
+
+    if (mapped) {
+        wl_list_insert(&workspace->top_levels, &top_level->link);
+        index_update(top_level);
+    }
+    if (tiled) {
+        tile_insert(top_level);
+    }
+    if (server->seat->keyboard_state.focused_surface == top_level->xdg_top_level->base->surface) {
+        focus_workspace_top(server);
+    }
+}
+
+// fullscreen moves the top-level into its workspace's layer_fullscreen over a black backdrop the
+// size of the output. once the client's opaque buffer covers the output, the scene has a single
+// visible buffer there and wlr_scene_output_commit scans it out directly instead of compositing
+static void set_fullscreen(struct tm_top_level* top_level,
+                           bool                 fullscreen,
+                           struct wlr_output*   output) {
+    struct tm_server*        server        = top_level->server;
+    struct wlr_xdg_toplevel* xdg_top_level = top_level->xdg_top_level;
+
+    if (fullscreen && output == NULL) {
+        output = top_level_output(top_level);
+    }
+    if (!fullscreen || output == NULL) {
+        if (top_level->fullscreen) {
+            transaction_hold(top_level, top_level->saved_box.width, top_level->saved_box.height);
+            fullscreen_clear(top_level);
+            wlr_xdg_toplevel_set_fullscreen(xdg_top_level, false);
+            struct tm_output* maximized_output =
+                top_level->maximized ? top_level_tm_output(top_level) : NULL;
+            if (top_level->tile != NULL) {
+                tile_place(top_level);
+            } else if (maximized_output != NULL) {
+                maximize_apply(top_level, maximized_output);
+            } else {
+                top_level->maximized = false;
+                wlr_xdg_toplevel_set_maximized(xdg_top_level, false);
+                wlr_scene_node_set_position(&top_level->scene_tree->node, top_level->saved_box.x,
+                                            top_level->saved_box.y);
+                top_level->transaction_serial = wlr_xdg_toplevel_set_size(
+                    xdg_top_level, top_level->saved_box.width, top_level->saved_box.height);
+            }
+        } else {
+            // the protocol wants a configure in reply even when nothing changes
+            wlr_xdg_surface_schedule_configure(xdg_top_level->base);
+        }
+        return;
+    }
+
+    struct wlr_box box;
+    wlr_output_layout_get_box(server->output_layout, output, &box);
+    transaction_hold(top_level, box.width, box.height);
+
+    if (!top_level->fullscreen) {
+        if (!top_level->maximized) {
+            top_level_save_box(top_level);
+        }
+
+        const float            black[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        struct wlr_scene_tree* layer    = top_level->workspace->layer_fullscreen;
+        top_level->fullscreen_background =
+            wlr_scene_rect_create(layer, box.width, box.height, black);
+        wlr_scene_node_reparent(&top_level->scene_tree->node, layer);
+        top_level->fullscreen = true;
+    }
+
+    top_level->fullscreen_output = output;
+    top_level->fullscreen_box    = box;
+    wlr_scene_rect_set_size(top_level->fullscreen_background, box.width, box.height);
+    wlr_scene_node_set_position(&top_level->fullscreen_background->node, box.x, box.y);
+    wlr_scene_node_place_below(&top_level->fullscreen_background->node,
+                               &top_level->scene_tree->node);
+    fullscreen_place(top_level);
+    if (xdg_top_level->base->surface->mapped) {
+        index_update(top_level);
+    }
+
+    wlr_xdg_toplevel_set_fullscreen(xdg_top_level, true);
+    top_level->transaction_serial = wlr_xdg_toplevel_set_size(xdg_top_level, box.width, box.height);
+}
+
+// every call ends in exactly one configure, wlroots merges the state and size changes into it
+static void set_maximized(struct tm_top_level* top_level, bool maximized) {
+    struct wlr_xdg_toplevel* xdg_top_level = top_level->xdg_top_level;
+
+    // tiles already take what the layout gives them
+    if (top_level->tile != NULL) {
+        wlr_xdg_surface_schedule_configure(xdg_top_level->base);
+        return;
+    }
+
+    // fullscreen geometry wins, the flag is applied once fullscreen is left
+    if (maximized == top_level->maximized || top_level->fullscreen) {
+        top_level->maximized = maximized;
+        wlr_xdg_toplevel_set_maximized(xdg_top_level, maximized);
+        return;
+    }
+
+    if (!maximized) {
+        transaction_hold(top_level, top_level->saved_box.width, top_level->saved_box.height);
+        top_level->maximized        = false;
+        top_level->maximized_output = NULL;
+        wlr_scene_node_set_position(&top_level->scene_tree->node, top_level->saved_box.x,
+                                    top_level->saved_box.y);
+        wlr_xdg_toplevel_set_maximized(xdg_top_level, false);
+        top_level->transaction_serial = wlr_xdg_toplevel_set_size(
+            xdg_top_level, top_level->saved_box.width, top_level->saved_box.height);
+        if (xdg_top_level->base->surface->mapped) {
+            index_update(top_level);
+        }
+        return;
+    }
+
+    struct tm_output* output = top_level_tm_output(top_level);
+    if (output == NULL) {
+        wlr_xdg_surface_schedule_configure(xdg_top_level->base);
+        return;
+    }
+    top_level_save_box(top_level);
+    maximize_apply(top_level, output);
+}
+
+// sizes and places a maximized top-level in the output's cached usable area
+static void maximize_apply(struct tm_top_level* top_level, struct tm_output* output) {
+    struct wlr_xdg_toplevel* xdg_top_level = top_level->xdg_top_level;
+    struct wlr_box*          geometry      = &xdg_top_level->base->geometry;
+
+    transaction_hold(top_level, output->usable_area.width, output->usable_area.height);
+    top_level->maximized        = true;
+    top_level->maximized_output = output->wlr_output;
+    top_level->maximized_box    = output->usable_area;
+    wlr_scene_node_set_position(&top_level->scene_tree->node,
+                                output->usable_area.x - geometry->x,
+                                output->usable_area.y - geometry->y);
+    wlr_xdg_toplevel_set_maximized(xdg_top_level, true);
+    top_level->transaction_serial = wlr_xdg_toplevel_set_size(
+        xdg_top_level, output->usable_area.width, output->usable_area.height);
+    if (xdg_top_level->base->surface->mapped) {
+        index_update(top_level);
+    }
+}
+
+// remembers the floating geometry, called when leaving the floating state
+static void top_level_save_box(struct tm_top_level* top_level) {
+    struct tm_server* server = top_level->server;
+    if (server->grabbed_top_level == top_level) {
+        reset_cursor_mode(server);
+    }
+    resize_snapshot_drop(top_level);
+    top_level->saved_box = (struct wlr_box){
+        .x      = top_level->scene_tree->node.x,
+        .y      = top_level->scene_tree->node.y,
+        .width  = top_level->xdg_top_level->base->geometry.width,
+        .height = top_level->xdg_top_level->base->geometry.height,
+    };
+}
+
+// keeps the window geometry, not the buffer, at the output origin so client side shadows don't
+// push the surface off the output
+static void fullscreen_place(struct tm_top_level* top_level) {
+    struct wlr_box* geometry = &top_level->xdg_top_level->base->geometry;
+    wlr_scene_node_set_position(&top_level->scene_tree->node,
+                                top_level->fullscreen_box.x - geometry->x,
+                                top_level->fullscreen_box.y - geometry->y);
+}
+
+// drops fullscreen scene state without configuring the client
+static void fullscreen_clear(struct tm_top_level* top_level) {
+    if (!top_level->fullscreen) {
+        return;
+    }
+    wlr_scene_node_destroy(&top_level->fullscreen_background->node);
+    wlr_scene_node_reparent(&top_level->scene_tree->node, top_level->workspace->layer_normal);
+    top_level->fullscreen_background   = NULL;
+    top_level->fullscreen_output       = NULL;
+    top_level->fullscreen              = false;
+    top_level->server->occlusion_dirty = true;
+}
+
+// output under the top-level's center, or under the cursor while it has no size yet
+static struct wlr_output* top_level_output(struct tm_top_level* top_level) {
+    struct tm_server* server   = top_level->server;
+    struct wlr_box*   geometry = &top_level->xdg_top_level->base->geometry;
+
+    double x = server->cursor->x;
+    double y = server->cursor->y;
+    if (top_level->xdg_top_level->base->surface->mapped) {
+        x = top_level->scene_tree->node.x + geometry->x + geometry->width / 2.0;
+        y = top_level->scene_tree->node.y + geometry->y + geometry->height / 2.0;
+    }
+
+    struct wlr_output* output = wlr_output_layout_output_at(server->output_layout, x, y);
+    return output != NULL ? output : wlr_output_layout_get_center_output(server->output_layout);
+}
+
+static struct tm_output* top_level_tm_output(struct tm_top_level* top_level) {
+    struct wlr_output* output = top_level_output(top_level);
+    return output != NULL ? output->data : NULL;
+}
+
+// scene order: the fullscreen layer first, then most recently raised first
+static bool stacked_above(const struct tm_top_level* a, const struct tm_top_level* b) {
+    if (a->fullscreen != b->fullscreen) {
+        return a->fullscreen;
+    }
+    return a->stack_seq > b->stack_seq;
+}
+
+// top-level holding keyboard focus, NULL if it is something else or nothing
+static struct tm_top_level* focused_top_level(struct tm_server* server) {
+    struct wlr_surface* focused = server->seat->keyboard_state.focused_surface;
+    struct wlr_xdg_toplevel* xdg_top_level =
+        focused != NULL ? wlr_xdg_toplevel_try_from_wlr_surface(focused) : NULL;
+    if (xdg_top_level == NULL) {
+        return NULL;
+    }
+    struct wlr_scene_tree* tree = xdg_top_level->base->data;
+    return tree->node.data;
+}
+
+// tiles the top-level next to the most recently focused tile of its workspace, it stays
+// floating if the layout can't take it
+static void tile_insert(struct tm_top_level* top_level) {
+    struct tm_server*      server    = top_level->server;
+    struct tm_workspace*   workspace = top_level->workspace;
+    struct tm_layout_node* sibling   = NULL;
+
+    if (workspace->output == NULL) {
+        struct wlr_output_layout* layout = server->output_layout;
+        struct wlr_output*        output =
+            wlr_output_layout_output_at(layout, server->cursor->x, server->cursor->y);
+        if (output == NULL) {
+            output = wlr_output_layout_get_center_output(layout);
+        }
+        workspace->output = output != NULL ? output->data : NULL;
+        workspace_update_output(server, workspace);
+    }
+
+    struct tm_top_level* focused;
+    wl_list_for_each(focused, &workspace->top_levels, link) {
+        if (focused->tile != NULL) {
+            sibling = focused->tile;
+            break;
+        }
+    }
+
+    top_level->tile = tm_layout_insert(&workspace->layout, sibling, top_level);
+    if (top_level->tile == NULL) {
+        // it may come from a stack that had hidden it
+        wlr_scene_node_set_enabled(&top_level->scene_tree->node, true);
+        return;
+    }
+    wlr_xdg_toplevel_set_tiled(top_level->xdg_top_level,
+                               WLR_EDGE_TOP | WLR_EDGE_BOTTOM | WLR_EDGE_LEFT | WLR_EDGE_RIGHT);
+    workspace_arrange(top_level->server, workspace);
+}
+
+static void tile_remove(struct tm_top_level* top_level) {
+    tm_layout_remove(&top_level->workspace->layout, top_level->tile);
+    top_level->tile = NULL;
+    // the next first tile picks the output under the pointer again
+    if (top_level->workspace->layout.root->first_child == NULL) {
+        top_level->workspace->output = NULL;
+    }
+    workspace_arrange(top_level->server, top_level->workspace);
+}
+
+// one configure with the tile's size, the commit handler keeps the geometry at the tile origin
+static void tile_place(struct tm_top_level* top_level) {
+    struct tm_layout_box* box      = &top_level->tile->box;
+    struct wlr_box*       geometry = &top_level->xdg_top_level->base->geometry;
+
+    transaction_hold(top_level, box->width, box->height);
+    wlr_scene_node_set_position(&top_level->scene_tree->node, box->x - geometry->x,
+                                box->y - geometry->y);
+    top_level->transaction_serial =
+        wlr_xdg_toplevel_set_size(top_level->xdg_top_level, box->width, box->height);
+    if (top_level->xdg_top_level->base->surface->mapped) {
+        index_update(top_level);
+    }
+    top_level->server->layout_configures++;
+}
+
+// keeps the layout on the usable area of the workspace's output. tiles of an output that left
+// the layout move to the one at the center, a workspace without tiles waits for the next insert
+static void workspace_update_output(struct tm_server* server, struct tm_workspace* workspace) {
+    struct tm_output*         output = workspace->output;
+    struct wlr_output_layout* layout = server->output_layout;
+    if (output != NULL && wlr_output_layout_get(layout, output->wlr_output) == NULL) {
+        output = NULL;
+    }
+    if (output == NULL && workspace->layout.root->first_child != NULL) {
+        struct wlr_output* center = wlr_output_layout_get_center_output(layout);
+        output                    = center != NULL ? center->data : NULL;
+    }
+
+    workspace->output = output;
+    if (output != NULL) {
+        struct wlr_box* area = &output->usable_area;
+        tm_layout_set_area(&workspace->layout,
+                           (struct tm_layout_box){area->x, area->y, area->width, area->height});
+    }
+}
+
+// one layout pass over the dirty part of the tree, every tile that changed is configured once
+// no matter how many map, unmap or resize steps led to it
+static void workspace_arrange(struct tm_server* server, struct tm_workspace* workspace) {
+    struct tm_layout* layout = &workspace->layout;
+    if (!server->tiling || (!layout->root->dirty && !layout->root->child_dirty)) {
+        return;
+    }
+
+    int64_t                start   = monotonic_ns();
+    bool                   dropped = false;
+    struct tm_layout_node* node    = tm_layout_arrange(layout);
+    for (; node != NULL; node = node->changed_next) {
+        struct tm_top_level* top_level = node->data;
+        if (node->hidden && top_level->snapshot != NULL) {
+            transaction_drop(top_level);
+            dropped = true;
+        }
+        wlr_scene_node_set_enabled(&top_level->scene_tree->node,
+                                   !node->hidden && top_level->snapshot == NULL);
+        // fullscreen geometry wins, the tile is applied once fullscreen is left. hidden tiles
+        // are configured when their stack shows them
+        if (!node->hidden && !top_level->fullscreen) {
+            tile_place(top_level);
+        }
+    }
+    // a hidden tile may have been the last one the transaction waited for
+    if (dropped) {
+        transaction_try_apply(server);
+    }
+    tm_histogram_add(&server->layout_time, monotonic_ns() - start);
+}
+
+// called before the compositor moves or configures a top-level for a new layout. it keeps
+// showing what it shows now until the client committed a buffer for the configure stored in
+// transaction_serial, or until the transaction times out. a configure that keeps the size needs
+// no new buffer, it only waits for the others
+static void transaction_hold(struct tm_top_level* top_level, int width, int height) {
+    struct tm_server* server   = top_level->server;
+    struct wlr_box*   geometry = &top_level->xdg_top_level->base->geometry;
+    bool              wait     = width != geometry->width || height != geometry->height;
+
+    if (top_level->snapshot != NULL) {
+        if (wait && top_level->transaction_ready) {
+            top_level->transaction_ready = false;
+            server->transaction_waiting++;
+        }
+        return;
+    }
+    // nothing on screen to hold
+    if (server->transaction_timeout_ms <= 0 || !top_level->xdg_top_level->base->surface->mapped ||
+        top_level->workspace != server->workspace || !top_level->scene_tree->node.enabled) {
+        return;
+    }
+
+    struct wlr_scene_node* live = &top_level->scene_tree->node;
+    top_level->snapshot         = wlr_scene_tree_create(live->parent);
+    if (top_level->snapshot == NULL) {
+        return;
+    }
+    wlr_scene_node_set_position(&top_level->snapshot->node, live->x, live->y);
+    wlr_scene_node_place_above(&top_level->snapshot->node, live);
+    wlr_scene_node_for_each_buffer(live, snapshot_buffer, top_level);
+    wlr_scene_node_set_enabled(live, false);
+
+    if (wl_list_empty(&server->transaction)) {
+        server->transaction_start_ns = monotonic_ns();
+        wl_event_source_timer_update(server->transaction_timer, server->transaction_timeout_ms);
+    }
+    wl_list_insert(&server->transaction, &top_level->transaction_link);
+    top_level->transaction_ready = !wait;
+    server->transaction_waiting += wait;
+}
+
+// copies one buffer of the live tree into the snapshot, sx and sy include the live tree's own
+// position
+static void snapshot_buffer(struct wlr_scene_buffer* buffer, int sx, int sy, void* data) {
+    struct tm_top_level* top_level = data;
+    if (buffer->buffer == NULL) {
+        return;
+    }
+
+    // the scene buffer holds a lock on the client buffer until the snapshot goes away
+    struct wlr_scene_buffer* copy = wlr_scene_buffer_create(top_level->snapshot, buffer->buffer);
+    if (copy == NULL) {
+        return;
+    }
+    wlr_scene_node_set_position(&copy->node, sx - top_level->scene_tree->node.x,
+                                sy - top_level->scene_tree->node.y);
+    wlr_scene_buffer_set_dest_size(copy, buffer->dst_width, buffer->dst_height);
+    wlr_scene_buffer_set_source_box(copy, &buffer->src_box);
+    wlr_scene_buffer_set_transform(copy, buffer->transform);
+    wlr_scene_buffer_set_opacity(copy, buffer->opacity);
+    wlr_scene_buffer_set_opaque_region(copy, &buffer->opaque_region);
+}
+
+// takes a top-level out of the transaction and shows its live tree again
+static void transaction_drop(struct tm_top_level* top_level) {
+    struct tm_server* server = top_level->server;
+    if (top_level->snapshot == NULL) {
+        return;
+    }
+    if (!top_level->transaction_ready) {
+        server->transaction_waiting--;
+    }
+    wl_list_remove(&top_level->transaction_link);
+    wlr_scene_node_destroy(&top_level->snapshot->node);
+    top_level->snapshot = NULL;
+    wlr_scene_node_set_enabled(&top_level->scene_tree->node,
+                               top_level->tile == NULL || !top_level->tile->hidden);
+    server->occlusion_dirty = true;
+}
+
+static void transaction_try_apply(struct tm_server* server) {
+    if (server->transaction_waiting == 0 && !wl_list_empty(&server->transaction)) {
+        transaction_apply(server);
+    }
+}
+
+// every participant switches to its new buffer and position in the same scene update, so they
+// reach the screen in the same frame
+static void transaction_apply(struct tm_server* server) {
+    tm_histogram_add(&server->transaction_time, monotonic_ns() - server->transaction_start_ns);
+    wl_event_source_timer_update(server->transaction_timer, 0);
+
+    struct tm_top_level* top_level;
+    struct tm_top_level* tmp;
+    wl_list_for_each_safe(top_level, tmp, &server->transaction, transaction_link) {
+        transaction_drop(top_level);
+    }
+}
+
+static int transaction_timeout(void* data) {
+    struct tm_server* server = data;
+    if (!wl_list_empty(&server->transaction)) {
+        server->transactions_timed_out++;
+        transaction_apply(server);
+    }
+    return 0;
+}
+
+static void surface_frame_done(struct wlr_surface*  surface,
+                               [[maybe_unused]] int sx,
+                               [[maybe_unused]] int sy,
+                               void*                data) {
+    wlr_surface_send_frame_done(surface, data);
+}
+
 static void reset_cursor_mode(struct tm_server* server) {
+    // the final size of an interactive resize is never dropped
+    struct tm_top_level* top_level = server->grabbed_top_level;
+    if (top_level != NULL && top_level->resize_pending) {
+        if (top_level->xdg_top_level->base->surface->mapped) {
+            flush_resize(top_level);
+        }
+        top_level->resize_pending = false;
+    }
     server->cursor_mode       = TM_CURSOR_PASSTHROUGH;
     server->grabbed_top_level = NULL;
+    // stays stretched only while the client still owes a buffer for the last configure
+    if (top_level != NULL && top_level->resize_snapshot.tree != NULL) {
+        resize_snapshot_update(top_level, false);
+    }
 }
 
 // sets up interactive move or resize operation
@@ -628,6 +2714,11 @@ static void
 begin_interactive(struct tm_top_level* top_level, enum tm_cursor_mode mode, uint32_t edges) {
     struct tm_server*   server          = top_level->server;
     struct wlr_surface* focused_surface = server->seat->pointer_state.focused_surface;
+    // tiles can be resized against their neighbours but only the layout moves them
+    if (top_level->fullscreen || top_level->maximized ||
+        (top_level->tile != NULL && mode == TM_CURSOR_MOVE)) {
+        return;
+    }
     if (top_level->xdg_top_level->base->surface != wlr_surface_get_root_surface(focused_surface)) {
         // trying to move or resize unfocused clients
         return;
@@ -635,6 +2726,12 @@ begin_interactive(struct tm_top_level* top_level, enum tm_cursor_mode mode, uint
 
     server->grabbed_top_level = top_level;
     server->cursor_mode       = mode;
+    // a resize starts from what the client shows, not from a layout or the previous resize
+    if (top_level->snapshot != NULL) {
+        transaction_drop(top_level);
+        transaction_try_apply(server);
+    }
+    resize_snapshot_drop(top_level);
 
     if (mode == TM_CURSOR_MOVE) {
         server->grab_x = server->cursor->x - top_level->scene_tree->node.x;
@@ -665,11 +2762,37 @@ static void process_cursor_motion(struct tm_server* server, uint32_t time) {
         return;
     }
 
+    server->motion_events++;
+    if (!server->coalesce_motion) {
+        process_pointer_focus(server, time, true);
+        return;
+    }
+
+    struct wlr_seat*   seat   = server->seat;
+    struct wlr_output* output = wlr_output_layout_output_at(server->output_layout,
+                                                            server->cursor->x, server->cursor->y);
+    if (output == NULL) {
+        process_pointer_focus(server, time, true);
+        return;
+    }
+
+    // the focused surface hasn't moved since the last hit test unless a frame is pending
+    if (seat->pointer_state.focused_surface != NULL) {
+        wlr_seat_pointer_notify_motion(seat, time, server->cursor->x - server->pointer_origin_x,
+                                       server->cursor->y - server->pointer_origin_y);
+    }
+    server->motion_pending   = true;
+    server->last_motion_time = time;
+    wlr_output_schedule_frame(output);
+}
+
+static void process_pointer_focus(struct tm_server* server, uint32_t time, bool send_motion) {
     double               sx, sy;
     struct wlr_seat*     seat    = server->seat;
     struct wlr_surface*  surface = NULL;
     struct tm_top_level* top_level =
         desktop_top_level_at(server, server->cursor->x, server->cursor->y, &surface, &sx, &sy);
+    server->hit_tests++;
 
     if (!top_level) {
         // if cursor is not over a top_level node, set the cursor to default
@@ -677,17 +2800,33 @@ static void process_cursor_motion(struct tm_server* server, uint32_t time) {
     }
 
     if (surface) {
+        server->pointer_origin_x = server->cursor->x - sx;
+        server->pointer_origin_y = server->cursor->y - sy;
+
         wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
-        wlr_seat_pointer_notify_motion(seat, time, sx, sy);
+        if (send_motion) {
+            wlr_seat_pointer_notify_motion(seat, time, sx, sy);
+        }
     } else {
         wlr_seat_pointer_clear_focus(seat);
     }
 }
 
+// resolves focus for motion coalesced since the last frame, before anything that depends on it
+static void flush_pointer_focus(struct tm_server* server) {
+    if (!server->motion_pending) {
+        return;
+    }
+    server->motion_pending = false;
+    // motion was already delivered to the old focus, enter carries the position for a new one
+    process_pointer_focus(server, server->last_motion_time, false);
+}
+
 static void process_cursor_move(struct tm_server* server) {
     struct tm_top_level* top_level = server->grabbed_top_level;
     wlr_scene_node_set_position(&top_level->scene_tree->node, server->cursor->x - server->grab_x,
                                 server->cursor->y - server->grab_y);
+    index_update(top_level);
 }
 
 static void process_cursor_resize(struct tm_server* server) {
@@ -724,13 +2863,386 @@ static void process_cursor_resize(struct tm_server* server) {
         }
     }
 
-    struct wlr_box* geo_box = &toplevel->xdg_top_level->base->geometry;
-    wlr_scene_node_set_position(&toplevel->scene_tree->node, new_left - geo_box->x,
-                                new_top - geo_box->y);
+    server->resize_motion_events++;
+    toplevel->resize_box = (struct wlr_box){
+        .x      = new_left,
+        .y      = new_top,
+        .width  = new_right - new_left,
+        .height = new_bottom - new_top,
+    };
+    toplevel->resize_pending = true;
+    // tiles keep showing their old buffers through the layout transaction instead
+    if (toplevel->tile == NULL && server->resize_snapshot) {
+        resize_snapshot_update(toplevel, false);
+    }
+
+    switch (server->resize_mode) {
+    case TM_RESIZE_PER_EVENT:
+        flush_resize(toplevel);
+        break;
+    case TM_RESIZE_ACK:
+        if (!resize_in_flight(toplevel)) {
+            flush_resize(toplevel);
+        }
+        break;
+    case TM_RESIZE_FRAME: {
+        struct wlr_output* output = wlr_output_layout_output_at(
+            server->output_layout, server->cursor->x, server->cursor->y);
+        if (output != NULL) {
+            wlr_output_schedule_frame(output);
+        } else {
+            flush_resize(toplevel);
+        }
+        break;
+    }
+    }
+}
+
+static void flush_resize(struct tm_top_level* top_level) {
+    struct wlr_box* box     = &top_level->resize_box;
+    struct wlr_box* geo_box = &top_level->xdg_top_level->base->geometry;
+
+    // a tile's size goes through the layout, which configures the grabbed tile and its
+    // neighbours in one pass. the ack throttle then waits on the grabbed tile's configure
+    if (top_level->tile != NULL) {
+        struct tm_workspace* workspace = top_level->workspace;
+        tm_layout_set_size(&workspace->layout, top_level->tile, box->width, box->height);
+        workspace_arrange(top_level->server, workspace);
+        top_level->resize_serial  = top_level->transaction_serial;
+        top_level->resize_pending = false;
+        top_level->server->resize_configures++;
+        return;
+    }
+
+    wlr_scene_node_set_position(&top_level->scene_tree->node, box->x - geo_box->x,
+                                box->y - geo_box->y);
+    index_update(top_level);
+
+    top_level->resize_serial =
+        wlr_xdg_toplevel_set_size(top_level->xdg_top_level, box->width, box->height);
+    top_level->resize_pending = false;
+    top_level->server->resize_configures++;
+}
+
+static bool resize_in_flight(struct tm_top_level* top_level) {
+    if (top_level->resize_serial == 0) {
+        return false;
+    }
+    // serials wrap, compare the distance instead of the values
+    uint32_t current = top_level->xdg_top_level->base->current.configure_serial;
+    return (int32_t)(current - top_level->resize_serial) < 0;
+}
+
+// follows the pointer at refresh rate whatever the client's pace: while the last committed
+// buffer doesn't have the size of resize_box, a copy of it is stretched over resize_box. called
+// on resize motion and on buffer commits, the client's own buffer is shown again once it
+// matches or once the resize is over and the client caught up with the last configure
+static void resize_snapshot_update(struct tm_top_level* top_level, bool new_buffer) {
+    struct tm_server* server   = top_level->server;
+    struct wlr_box*   geometry = &top_level->xdg_top_level->base->geometry;
+    struct wlr_box*   target   = &top_level->resize_box;
+
+    bool resizing =
+        server->grabbed_top_level == top_level && server->cursor_mode == TM_CURSOR_RESIZE;
+    if ((geometry->width == target->width && geometry->height == target->height) ||
+        (!resizing && !resize_in_flight(top_level))) {
+        if (top_level->resize_snapshot.tree != NULL) {
+            resize_snapshot_drop(top_level);
+            wlr_scene_node_set_position(&top_level->scene_tree->node, target->x - geometry->x,
+                                        target->y - geometry->y);
+        }
+        return;
+    }
+
+    // the first mismatch of this resize, or newer content to stretch
+    if (top_level->resize_snapshot.tree == NULL || new_buffer) {
+        resize_snapshot_take(top_level);
+    }
+    snapshot_scale(&top_level->resize_snapshot, &top_level->resize_box);
+}
+
+// copies the live tree's buffers into a fresh snapshot and hides the live tree
+static void resize_snapshot_take(struct tm_top_level* top_level) {
+    struct wlr_scene_node* live     = &top_level->scene_tree->node;
+    struct tm_snapshot*    snapshot = &top_level->resize_snapshot;
+
+    if (snapshot->tree != NULL) {
+        wlr_scene_node_destroy(&snapshot->tree->node);
+    }
+    snapshot->count = 0;
+    snapshot->tree  = wlr_scene_tree_create(live->parent);
+    if (snapshot->tree == NULL) {
+        wlr_scene_node_set_enabled(live, true);
+        return;
+    }
+    wlr_scene_node_place_above(&snapshot->tree->node, live);
+
+    // the live tree may already be disabled by the previous snapshot, so the walk starts below
+    // the root instead of going through wlr_scene_node_for_each_buffer
+    snapshot_add(snapshot, live, 0, 0);
+    snapshot->geometry = top_level->xdg_top_level->base->geometry;
+    wlr_scene_node_set_enabled(live, false);
+}
+
+static void resize_snapshot_drop(struct tm_top_level* top_level) {
+    if (top_level->resize_snapshot.tree == NULL) {
+        return;
+    }
+    wlr_scene_node_destroy(&top_level->resize_snapshot.tree->node);
+    top_level->resize_snapshot.tree  = NULL;
+    top_level->resize_snapshot.count = 0;
+    wlr_scene_node_set_enabled(&top_level->scene_tree->node, true);
+    top_level->server->occlusion_dirty = true;
+}
+
+// copies the enabled buffers below node into snapshot, x and y are node's position relative to
+// the root of the walk
+static void snapshot_add(struct tm_snapshot* snapshot, struct wlr_scene_node* node, int x, int y) {
+    if (node->type == WLR_SCENE_NODE_TREE) {
+        struct wlr_scene_node* child;
+        wl_list_for_each(child, &wlr_scene_tree_from_node(node)->children, link) {
+            if (child->enabled) {
+                snapshot_add(snapshot, child, x + child->x, y + child->y);
+            }
+        }
+        return;
+    }
+
+    struct wlr_scene_buffer* buffer = node->type == WLR_SCENE_NODE_BUFFER
+                                          ? wlr_scene_buffer_from_node(node)
+                                          : NULL;
+    if (buffer == NULL || buffer->buffer == NULL) {
+        return;
+    }
+
+    // entries are only reallocated when a snapshot has more buffers than ever before
+    if (snapshot->count == snapshot->capacity) {
+        int                        capacity = snapshot->capacity * 2 + 4;
+        struct tm_snapshot_buffer* buffers =
+            realloc(snapshot->buffers, capacity * sizeof(struct tm_snapshot_buffer));
+        if (buffers == NULL) {
+            return;
+        }
+        snapshot->buffers  = buffers;
+        snapshot->capacity = capacity;
+    }
+
+    struct wlr_scene_buffer* copy = wlr_scene_buffer_create(snapshot->tree, buffer->buffer);
+    if (copy == NULL) {
+        return;
+    }
+    wlr_scene_buffer_set_source_box(copy, &buffer->src_box);
+    wlr_scene_buffer_set_transform(copy, buffer->transform);
+    wlr_scene_buffer_set_opacity(copy, buffer->opacity);
+
+    struct tm_snapshot_buffer* entry = &snapshot->buffers[snapshot->count++];
+    entry->buffer = copy;
+    entry->box    = (struct wlr_box){
+        .x      = x,
+        .y      = y,
+        .width  = buffer->dst_width > 0 ? buffer->dst_width : buffer->buffer->width,
+        .height = buffer->dst_height > 0 ? buffer->dst_height : buffer->buffer->height,
+    };
+}
+
+// stretches the snapshot so the window geometry it was drawn at covers to
+static void snapshot_scale(struct tm_snapshot* snapshot, const struct wlr_box* to) {
+    struct wlr_box* from = &snapshot->geometry;
+    if (snapshot->tree == NULL || wlr_box_empty(from)) {
+        return;
+    }
+
+    double scale_x = (double)to->width / from->width;
+    double scale_y = (double)to->height / from->height;
+
+    wlr_scene_node_set_position(&snapshot->tree->node, to->x, to->y);
+    for (int i = 0; i < snapshot->count; i++) {
+        struct tm_snapshot_buffer* entry = &snapshot->buffers[i];
+
+        int x1 = round((entry->box.x - from->x) * scale_x);
+        int y1 = round((entry->box.y - from->y) * scale_y);
+        int x2 = round((entry->box.x + entry->box.width - from->x) * scale_x);
+        int y2 = round((entry->box.y + entry->box.height - from->y) * scale_y);
+        wlr_scene_node_set_position(&entry->buffer->node, x1, y1);
+        wlr_scene_buffer_set_dest_size(entry->buffer, x2 > x1 ? x2 - x1 : 1, y2 > y1 ? y2 - y1 : 1);
+    }
+}
+
+// runs an animation from the next frame on, or jumps straight to its end when animations are
+// off or every slot is busy
+static void animate(struct tm_server*                server,
+                    void*                            target,
+                    enum tm_animation_kind           kind,
+                    enum tm_easing                   easing,
+                    const struct tm_animation_state* from,
+                    const struct tm_animation_state* to) {
+    struct tm_animation immediate = {.target = target, .kind = kind};
+    if (server->animation_ns <= 0 || !tm_animation_start(&server->animator, target, kind, easing,
+                                                         monotonic_ns(), server->animation_ns,
+                                                         from, to)) {
+        animation_apply(&immediate, to, true, server);
+        return;
+    }
+    animation_apply(&immediate, from, false, server);
+
+    struct tm_output* output;
+    wl_list_for_each(output, &server->outputs, link) {
+        wlr_output_schedule_frame(output->wlr_output);
+    }
+}
+
+static void animation_apply(const struct tm_animation*       animation,
+                            const struct tm_animation_state* state,
+                            bool                             done,
+                            void*                            data) {
+    struct tm_server* server = data;
+    // fading buffers aren't opaque and moving trees uncover others
+    server->occlusion_dirty = true;
+
+    switch ((enum tm_animation_kind)animation->kind) {
+    case TM_ANIMATE_OPEN: {
+        struct tm_top_level* top_level = animation->target;
+        tree_set_opacity(&top_level->scene_tree->node, state->opacity);
+        break;
+    }
+    case TM_ANIMATE_CLOSE: {
+        struct tm_closing* closing = animation->target;
+        if (done) {
+            closing_destroy(closing);
+            break;
+        }
+        struct wlr_box box = {
+            .x      = round(state->x),
+            .y      = round(state->y),
+            .width  = round(state->width),
+            .height = round(state->height),
+        };
+        snapshot_scale(&closing->snapshot, &box);
+        for (int i = 0; i < closing->snapshot.count; i++) {
+            wlr_scene_buffer_set_opacity(closing->snapshot.buffers[i].buffer, state->opacity);
+        }
+        break;
+    }
+    case TM_ANIMATE_WORKSPACE: {
+        struct tm_workspace* workspace = animation->target;
+        wlr_scene_node_set_position(&workspace->tree->node, round(state->x), 0);
+        if (done && workspace != server->workspace) {
+            wlr_scene_node_set_enabled(&workspace->tree->node, false);
+            wlr_scene_node_set_position(&workspace->tree->node, 0, 0);
+        } else if (done) {
+            // the scene hit test missed the surfaces while they were away from their grid cells
+            process_pointer_focus(server, server->last_motion_time, false);
+        }
+        break;
+    }
+    }
+}
+
+// once per output frame while anything is animating, the next frame is asked for on every
+// output since the one showing an animation may not have been damaged by anything else
+static void animation_step(struct tm_server* server) {
+    int64_t start   = monotonic_ns();
+    bool    running = tm_animation_step(&server->animator, start, animation_apply, server);
+    tm_histogram_add(&server->animation_time, monotonic_ns() - start);
+    if (!running) {
+        return;
+    }
+
+    struct tm_output* output;
+    wl_list_for_each(output, &server->outputs, link) {
+        wlr_output_schedule_frame(output->wlr_output);
+    }
+}
+
+// every buffer below node, disabled ones included so none stays half faded when it comes back
+static void tree_set_opacity(struct wlr_scene_node* node, float opacity) {
+    if (node->type == WLR_SCENE_NODE_BUFFER) {
+        wlr_scene_buffer_set_opacity(wlr_scene_buffer_from_node(node), opacity);
+    } else if (node->type == WLR_SCENE_NODE_TREE) {
+        struct wlr_scene_node* child;
+        wl_list_for_each(child, &wlr_scene_tree_from_node(node)->children, link) {
+            tree_set_opacity(child, opacity);
+        }
+    }
+}
+
+// copies what an unmapping top-level shows into a snapshot that fades out and shrinks towards
+// its center where the window was
+static void closing_start(struct tm_top_level* top_level) {
+    struct tm_server*      server = top_level->server;
+    struct wlr_scene_node* live   = &top_level->scene_tree->node;
+
+    // a window closed while still fading in fades out from where it got to
+    struct tm_animation_state opening = {.opacity = 1.0};
+    tm_animation_current(&server->animator, top_level, monotonic_ns(), &opening);
+    tm_animation_cancel(&server->animator, top_level);
+
+    if (server->animation_ns <= 0 || top_level->workspace != server->workspace ||
+        (top_level->tile != NULL && top_level->tile->hidden)) {
+        return;
+    }
+
+    struct tm_closing* closing = calloc(1, sizeof(struct tm_closing));
+    if (closing == NULL) {
+        return;
+    }
+    closing->snapshot.tree = wlr_scene_tree_create(live->parent);
+    if (closing->snapshot.tree == NULL) {
+        free(closing);
+        return;
+    }
+    wlr_scene_node_place_above(&closing->snapshot.tree->node, live);
+    wl_list_insert(&server->closing, &closing->link);
+
+    // the unmap already disabled the surface's own tree, its subsurfaces and popups follow
+    // after this handler
+    struct wlr_scene_node* child;
+    wl_list_for_each(child, &top_level->scene_tree->children, link) {
+        snapshot_add(&closing->snapshot, child, child->x, child->y);
+    }
+    closing->snapshot.geometry = top_level->xdg_top_level->base->geometry;
+
+    struct wlr_box* geometry = &closing->snapshot.geometry;
+    if (closing->snapshot.count == 0 || wlr_box_empty(geometry)) {
+        closing_destroy(closing);
+        return;
+    }
+
+    struct tm_animation_state from = {
+        .x       = live->x + geometry->x,
+        .y       = live->y + geometry->y,
+        .width   = geometry->width,
+        .height  = geometry->height,
+        .opacity = opening.opacity,
+    };
+    struct tm_animation_state to = {
+        .x       = from.x + from.width * 0.05,
+        .y       = from.y + from.height * 0.05,
+        .width   = from.width * 0.9,
+        .height  = from.height * 0.9,
+        .opacity = 0.0,
+    };
+    animate(server, closing, TM_ANIMATE_CLOSE, TM_EASE_IN_CUBIC, &from, &to);
+}
+
+static void closing_destroy(struct tm_closing* closing) {
+    wl_list_remove(&closing->link);
+    wlr_scene_node_destroy(&closing->snapshot.tree->node);
+    free(closing->snapshot.buffers);
+    free(closing);
+}
 
-    int new_width  = new_right - new_left;
-    int new_height = new_bottom - new_top;
-    wlr_xdg_toplevel_set_size(toplevel->xdg_top_level, new_width, new_height);
+static enum tm_resize_mode resize_mode_from_env(void) {
+    const char* mode = getenv("TM_RESIZE_MODE");
+    if (mode == NULL || strcmp(mode, "ack") == 0) {
+        return TM_RESIZE_ACK;
+    } else if (strcmp(mode, "event") == 0) {
+        return TM_RESIZE_PER_EVENT;
+    } else if (strcmp(mode, "frame") == 0) {
+        return TM_RESIZE_FRAME;
+    }
+    fprintf(stderr, "unknown TM_RESIZE_MODE %s, using ack\n", mode);
+    return TM_RESIZE_ACK;
 }
 
 static struct tm_top_level* desktop_top_level_at(struct tm_server*    server,
@@ -740,7 +3252,62 @@ static struct tm_top_level* desktop_top_level_at(struct tm_server*    server,
                                                  double*              sx,
                                                  double*              sy) {
 
-    struct wlr_scene_node* node = wlr_scene_node_at(&server->scene->tree.node, lx, ly, sx, sy);
+    int cell_x = floor(lx / TM_GRID_CELL_SIZE);
+    int cell_y = floor(ly / TM_GRID_CELL_SIZE);
+
+    // gather the top-levels whose bounds contain the point, sorted top to bottom
+    struct tm_top_level* candidates[TM_GRID_MAX_CANDIDATES];
+    int                  candidate_count = 0;
+
+    struct tm_grid_entry* entry;
+    wl_list_for_each(entry, index_bucket(server->workspace, cell_x, cell_y), link) {
+        struct wlr_box* box = &entry->top_level->index_box;
+        if (entry->cell_x != cell_x || entry->cell_y != cell_y ||
+            !wlr_box_contains_point(box, lx, ly)) {
+            continue;
+        }
+        if (candidate_count == TM_GRID_MAX_CANDIDATES) {
+            return scene_top_level_at(&server->scene->tree.node, lx, ly, surface, sx, sy);
+        }
+
+        int i = candidate_count++;
+        while (i > 0 && stacked_above(entry->top_level, candidates[i - 1])) {
+            candidates[i] = candidates[i - 1];
+            i--;
+        }
+        candidates[i] = entry->top_level;
+    }
+
+    // bounds are conservative, the input region decides which candidate is actually hit
+    for (int i = 0; i < candidate_count; i++) {
+        struct tm_top_level* top_level =
+            scene_top_level_at(&candidates[i]->scene_tree->node, lx, ly, surface, sx, sy);
+        if (top_level != NULL) {
+            return top_level;
+        }
+        // the backdrop around a fullscreen surface smaller than its output takes the input, so
+        // does a snapshot shown in place of the surface
+        if (candidates[i]->fullscreen &&
+            wlr_box_contains_point(&candidates[i]->fullscreen_box, lx, ly)) {
+            return NULL;
+        }
+        double snapshot_x, snapshot_y;
+        if (candidates[i]->snapshot != NULL &&
+            wlr_scene_node_at(&candidates[i]->snapshot->node, lx, ly, &snapshot_x, &snapshot_y)) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static struct tm_top_level* scene_top_level_at(struct wlr_scene_node* root,
+                                               double                 lx,
+                                               double                 ly,
+                                               struct wlr_surface**   surface,
+                                               double*                sx,
+                                               double*                sy) {
+
+    struct wlr_scene_node* node = wlr_scene_node_at(root, lx, ly, sx, sy);
     if (node == NULL || node->type != WLR_SCENE_NODE_BUFFER) {
         return NULL;
     }
@@ -759,6 +3326,119 @@ static struct tm_top_level* desktop_top_level_at(struct tm_server*    server,
     return tree->node.data;
 }
 
+// re-files a mapped top-level under the grid cells its surface and popups cover
+static void index_update(struct tm_top_level* top_level) {
+    // commits reach here too, so opaque region changes are covered as well
+    top_level->server->occlusion_dirty = true;
+
+    struct wlr_box box = {0};
+    index_add_surface_box(&box, top_level->scene_tree, top_level->xdg_top_level->base->surface);
+
+    struct tm_popup* popup;
+    wl_list_for_each(popup, &top_level->popups, link) {
+        struct wlr_scene_tree* popup_tree = popup->xdg_popup->base->data;
+        if (popup->xdg_popup->base->surface->mapped && popup_tree != NULL) {
+            index_add_surface_box(&box, popup_tree, popup->xdg_popup->base->surface);
+        }
+    }
+    // the grid is where the workspace rests, not where a switch is sliding it through
+    box.x -= top_level->workspace->tree->node.x;
+    box.y -= top_level->workspace->tree->node.y;
+    if (top_level->fullscreen) {
+        index_add_box(&box, &top_level->fullscreen_box);
+    }
+
+    struct wlr_box* old = &top_level->index_box;
+    if (top_level->grid_entry_count > 0 && box.x == old->x && box.y == old->y &&
+        box.width == old->width && box.height == old->height) {
+        return;
+    }
+
+    index_remove(top_level);
+    top_level->index_box = box;
+    if (wlr_box_empty(&box)) {
+        return;
+    }
+
+    int first_x = floor((double)box.x / TM_GRID_CELL_SIZE);
+    int first_y = floor((double)box.y / TM_GRID_CELL_SIZE);
+    int last_x  = floor((double)(box.x + box.width - 1) / TM_GRID_CELL_SIZE);
+    int last_y  = floor((double)(box.y + box.height - 1) / TM_GRID_CELL_SIZE);
+    int count   = (last_x - first_x + 1) * (last_y - first_y + 1);
+
+    // entries are only reallocated when the top-level grows over more cells than ever before
+    if (count > top_level->grid_entry_capacity) {
+        struct tm_grid_entry* entries =
+            realloc(top_level->grid_entries, count * sizeof(struct tm_grid_entry));
+        if (entries == NULL) {
+            return;
+        }
+        top_level->grid_entries        = entries;
+        top_level->grid_entry_capacity = count;
+    }
+
+    struct tm_grid_entry* entry = top_level->grid_entries;
+    for (int y = first_y; y <= last_y; y++) {
+        for (int x = first_x; x <= last_x; x++) {
+            entry->top_level = top_level;
+            entry->cell_x    = x;
+            entry->cell_y    = y;
+            wl_list_insert(index_bucket(top_level->workspace, x, y), &entry->link);
+            entry++;
+        }
+    }
+    top_level->grid_entry_count = count;
+}
+
+static void index_remove(struct tm_top_level* top_level) {
+    top_level->server->occlusion_dirty = true;
+    for (int i = 0; i < top_level->grid_entry_count; i++) {
+        wl_list_remove(&top_level->grid_entries[i].link);
+    }
+    top_level->grid_entry_count = 0;
+}
+
+// grows box to cover the surface tree rooted at surface, in layout coordinates
+static void index_add_surface_box(struct wlr_box*        box,
+                                  struct wlr_scene_tree* tree,
+                                  struct wlr_surface*    surface) {
+    int lx, ly;
+    wlr_scene_node_coords(&tree->node, &lx, &ly);
+
+    struct wlr_box extents;
+    wlr_surface_get_extents(surface, &extents);
+    extents.x += lx;
+    extents.y += ly;
+    index_add_box(box, &extents);
+}
+
+static void index_add_box(struct wlr_box* box, const struct wlr_box* extents) {
+    if (wlr_box_empty(extents)) {
+        return;
+    }
+    if (wlr_box_empty(box)) {
+        *box = *extents;
+        return;
+    }
+
+    int x1      = extents->x < box->x ? extents->x : box->x;
+    int y1      = extents->y < box->y ? extents->y : box->y;
+    int x2      = extents->x + extents->width > box->x + box->width ? extents->x + extents->width
+                                                                    : box->x + box->width;
+    int y2      = extents->y + extents->height > box->y + box->height
+                      ? extents->y + extents->height
+                      : box->y + box->height;
+    box->x      = x1;
+    box->y      = y1;
+    box->width  = x2 - x1;
+    box->height = y2 - y1;
+}
+
+static struct wl_list* index_bucket(struct tm_workspace* workspace, int cell_x, int cell_y) {
+    uint32_t hash = (uint32_t)cell_x * 73856093u ^ (uint32_t)cell_y * 19349663u;
+    return &workspace->grid[hash % TM_GRID_BUCKETS];
+}
+
 static void server_new_keyboard(struct tm_server* server, struct wlr_input_device* device) {
     struct wlr_keyboard* wlr_keyboard = wlr_keyboard_from_input_device(device);
 
@@ -766,13 +3446,10 @@ static void server_new_keyboard(struct tm_server* server, struct wlr_input_devic
     keyboard->server             = server;
     keyboard->wlr_keyboard       = wlr_keyboard;
 
-    struct xkb_context* context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-    struct xkb_keymap*  keymap =
-        xkb_keymap_new_from_names(context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
-
-    wlr_keyboard_set_keymap(wlr_keyboard, keymap);
-    xkb_keymap_unref(keymap);
-    xkb_context_unref(context);
+    keyboard->keymap = server_keymap(server);
+    if (keyboard->keymap != NULL) {
+        wlr_keyboard_set_keymap(wlr_keyboard, keyboard->keymap->keymap);
+    }
     wlr_keyboard_set_repeat_info(wlr_keyboard, 25, 600);
 
     keyboard->modifiers.notify = keyboard_handle_modifiers;
@@ -788,25 +3465,331 @@ static void server_new_keyboard(struct tm_server* server, struct wlr_input_devic
     wl_list_insert(&server->keyboards, &keyboard->link);
 }
 
+// returns the keymap for the RMLVO names in the environment, compiling it at most once per
+// server and at most once per machine thanks to the on-disk cache
+static struct tm_keymap* server_keymap(struct tm_server* server) {
+    const char* rules   = getenv("XKB_DEFAULT_RULES");
+    const char* model   = getenv("XKB_DEFAULT_MODEL");
+    const char* layout  = getenv("XKB_DEFAULT_LAYOUT");
+    const char* variant = getenv("XKB_DEFAULT_VARIANT");
+    const char* options = getenv("XKB_DEFAULT_OPTIONS");
+
+    char names[512];
+    snprintf(names, sizeof(names), "%s:%s:%s:%s:%s", rules ? rules : "", model ? model : "",
+             layout ? layout : "", variant ? variant : "", options ? options : "");
+
+    struct tm_keymap* keymap;
+    wl_list_for_each(keymap, &server->keymaps, link) {
+        if (strcmp(keymap->names, names) == 0) {
+            return keymap;
+        }
+    }
+
+    // the file is named after the names alone, so a stale one gets overwritten instead of left
+    // behind, but it is only used when the xkb data it was compiled from hasn't changed since
+    char key[600];
+    snprintf(key, sizeof(key), "%s %" PRId64, names, keymap_data_stamp(server));
+
+    char path[4096];
+    bool has_path = cache_path(path, sizeof(path), "keymap", names, "xkb");
+
+    struct xkb_keymap* xkb_keymap = has_path ? keymap_load_cache(server, path, key) : NULL;
+    if (xkb_keymap == NULL) {
+        // unset names fall back to the same environment variables read above
+        xkb_keymap =
+            xkb_keymap_new_from_names(server->xkb_context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+        if (xkb_keymap == NULL) {
+            fprintf(stderr, "failed to compile keymap %s\n", names);
+            return NULL;
+        }
+        if (has_path) {
+            keymap_save_cache(xkb_keymap, path, key);
+        }
+    }
+
+    keymap         = calloc(1, sizeof(struct tm_keymap));
+    keymap->names  = strdup(names);
+    keymap->keymap = xkb_keymap;
+    wl_list_insert(&server->keymaps, &keymap->link);
+    return keymap;
+}
+
+// newest mtime among the xkb data directories and the ones holding the keymap components. an
+// xkeyboard-config upgrade or a new user layout renames files into them, which bumps it
+static int64_t keymap_data_stamp(struct tm_server* server) {
+    static const char* const components[] = {"", "/rules", "/keycodes", "/types", "/compat",
+                                             "/symbols"};
+
+    int64_t      newest = 0;
+    unsigned int count  = xkb_context_num_include_paths(server->xkb_context);
+    for (unsigned int i = 0; i < count; i++) {
+        const char* include = xkb_context_include_path_get(server->xkb_context, i);
+        for (size_t j = 0; j < sizeof(components) / sizeof(components[0]); j++) {
+            char        path[4096];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s%s", include, components[j]);
+            if (stat(path, &st) == 0 && timespec_to_ns(&st.st_mtim) > newest) {
+                newest = timespec_to_ns(&st.st_mtim);
+            }
+        }
+    }
+    return newest;
+}
+
+// the cache file starts with a comment line holding the RMLVO names and xkb data stamp it was
+// compiled from, so a hash collision, an edited file or an upgrade is caught before parsing
+static struct xkb_keymap*
+keymap_load_cache(struct tm_server* server, const char* path, const char* key) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct xkb_keymap* keymap      = NULL;
+    size_t             key_len     = strlen(key);
+    size_t             header_len  = key_len + 4;
+    bool               header_fits = (size_t)st.st_size > header_len;
+    if (header_fits && strncmp(data, "// ", 3) == 0 && strncmp(data + 3, key, key_len) == 0 &&
+        data[header_len - 1] == '\n') {
+        keymap = xkb_keymap_new_from_buffer(server->xkb_context, data + header_len,
+                                            st.st_size - header_len, XKB_KEYMAP_FORMAT_TEXT_V1,
+                                            XKB_KEYMAP_COMPILE_NO_FLAGS);
+    }
+
+    munmap(data, st.st_size);
+    return keymap;
+}
+
+static void keymap_save_cache(struct xkb_keymap* keymap, const char* path, const char* key) {
+    char* text = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    if (text == NULL) {
+        return;
+    }
+
+    // write next to the final path and rename so a concurrent reader never sees half a keymap
+    char tmp_path[4096 + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+
+    FILE* file = fopen(tmp_path, "w");
+    if (file != NULL) {
+        bool ok = fprintf(file, "// %s\n%s", key, text) > 0;
+        ok      = fclose(file) == 0 && ok;
+        if (!ok || rename(tmp_path, path) != 0) {
+            unlink(tmp_path);
+        }
+    }
+    free(text);
+}
+
+// path of a file in the cache directory for key, which is also written inside the file and
+// compared on load since the name only carries a hash of it
+static bool cache_path(char*       path,
+                       size_t      size,
+                       const char* prefix,
+                       const char* key,
+                       const char* extension) {
+    char        dir[4096];
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    const char* home       = getenv("HOME");
+    if (cache_home != NULL && *cache_home != '\0') {
+        snprintf(dir, sizeof(dir), "%s/tm-server", cache_home);
+    } else if (home != NULL && *home != '\0') {
+        snprintf(dir, sizeof(dir), "%s/.cache/tm-server", home);
+    } else {
+        return false;
+    }
+
+    // parent directories are expected to exist already
+    if (mkdir(dir, 0755) != 0 && access(dir, W_OK) != 0) {
+        return false;
+    }
+
+    // FNV-1a, the key line inside the file is what is actually matched
+    uint32_t hash = 2166136261u;
+    for (const char* c = key; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    snprintf(path, size, "%s/%s-%08x.%s", dir, prefix, hash, extension);
+    return true;
+}
+
 static void server_new_pointer(struct tm_server* server, struct wlr_input_device* device) {
     wlr_cursor_attach_input_device(server->cursor, device);
 }
 
-static bool handle_keybinding(struct tm_server* server, xkb_keysym_t sym) {
-    switch (sym) {
-    case XKB_KEY_Escape:
+static bool handle_keybinding(struct tm_server*   server,
+                              uint32_t            modifiers,
+                              const xkb_keysym_t* level0_syms,
+                              int                 level0_count,
+                              const xkb_keysym_t* syms,
+                              int                 count,
+                              bool                release) {
+    // pressing the modifiers of the next chord step must not cancel the chord
+    for (int i = 0; i < count; i++) {
+        if (is_modifier_sym(syms[i])) {
+            return false;
+        }
+    }
+
+    struct tm_binding_table* table = server->bindings;
+    if (server->chord != NULL && !release) {
+        table = server->chord;
+    }
+
+    // the translated syms only matter for keys whose shifted sym is bound on its own
+    const struct tm_binding* binding =
+        find_binding(table, modifiers, level0_syms, level0_count, release);
+    if (binding == NULL) {
+        binding = find_binding(table, modifiers, syms, count, release);
+    }
+
+    if (server->chord != NULL && !release) {
+        // any key press ends the chord, an unbound one is swallowed rather than typed
+        server->chord = NULL;
+        if (binding == NULL) {
+            return true;
+        }
+    }
+    if (binding == NULL) {
+        return false;
+    }
+
+    run_binding(server, binding);
+    // the press already went to the client, so its release has to follow
+    return !release;
+}
+
+// a key runs at most one binding, the first of its syms that is bound
+static const struct tm_binding* find_binding(const struct tm_binding_table* table,
+                                             uint32_t                       modifiers,
+                                             const xkb_keysym_t*            syms,
+                                             int                            count,
+                                             bool                           release) {
+    const struct tm_binding* binding = NULL;
+    for (int i = 0; i < count && binding == NULL; i++) {
+        binding = tm_binding_table_find(table, modifiers, xkb_keysym_to_lower(syms[i]), release);
+    }
+    return binding;
+}
+
+static bool is_modifier_sym(xkb_keysym_t sym) {
+    return (sym >= XKB_KEY_Shift_L && sym <= XKB_KEY_Hyper_R) ||
+           (sym >= XKB_KEY_ISO_Lock && sym <= XKB_KEY_ISO_Level5_Lock);
+}
+
+static void run_binding(struct tm_server* server, const struct tm_binding* binding) {
+    switch (binding->action) {
+    case TM_ACTION_QUIT:
         wl_display_terminate(server->wl_display);
         break;
-    case XKB_KEY_F1:
-        if (wl_list_length(&server->top_levels) < 2) {
+    case TM_ACTION_FOCUS_NEXT:
+        if (wl_list_length(&server->workspace->top_levels) < 2) {
             break;
         }
         struct tm_top_level* next_toplevel =
-            wl_container_of(server->top_levels.prev, next_toplevel, link);
+            wl_container_of(server->workspace->top_levels.prev, next_toplevel, link);
         focus_top_level(next_toplevel, next_toplevel->xdg_top_level->base->surface);
         break;
-    default:
-        return false;
+    case TM_ACTION_WORKSPACE:
+        if (binding->workspace <= TM_WORKSPACE_COUNT) {
+            switch_workspace(server, &server->workspaces[binding->workspace - 1]);
+        }
+        break;
+    case TM_ACTION_MOVE_TO_WORKSPACE: {
+        struct tm_top_level* top_level = focused_top_level(server);
+        if (top_level != NULL && binding->workspace <= TM_WORKSPACE_COUNT) {
+            move_to_workspace(top_level, &server->workspaces[binding->workspace - 1]);
+        }
+        break;
+    }
+    case TM_ACTION_LAYOUT:
+    case TM_ACTION_SPLIT: {
+        struct tm_top_level* top_level = focused_top_level(server);
+        if (top_level == NULL || top_level->tile == NULL) {
+            break;
+        }
+        struct tm_layout* layout = &top_level->workspace->layout;
+        if (binding->action == TM_ACTION_LAYOUT) {
+            tm_layout_set_kind(layout, top_level->tile, binding->layout);
+        } else {
+            tm_layout_split(layout, top_level->tile, binding->layout);
+        }
+        workspace_arrange(server, top_level->workspace);
+        break;
+    }
+    case TM_ACTION_EXEC:
+        spawn_command(binding->command);
+        break;
+    case TM_ACTION_CHORD:
+        server->chord = binding->chord;
+        break;
+    case TM_ACTION_NONE:
+        break;
+    }
+}
+
+// bindings come from $TM_BINDINGS, $XDG_CONFIG_HOME/tm-server/bindings or
+// ~/.config/tm-server/bindings, in that order, falling back to the built-in set
+static void load_bindings(struct tm_server* server) {
+    server->bindings = tm_binding_table_create();
+    assert(server->bindings);
+
+    char        path[4096];
+    const char* env         = getenv("TM_BINDINGS");
+    const char* config_home = getenv("XDG_CONFIG_HOME");
+    const char* home        = getenv("HOME");
+    if (env != NULL && *env != '\0') {
+        snprintf(path, sizeof(path), "%s", env);
+    } else if (config_home != NULL && *config_home != '\0') {
+        snprintf(path, sizeof(path), "%s/tm-server/bindings", config_home);
+    } else if (home != NULL && *home != '\0') {
+        snprintf(path, sizeof(path), "%s/.config/tm-server/bindings", home);
+    } else {
+        path[0] = '\0';
+    }
+
+    if (path[0] != '\0' && tm_bindings_load(server->bindings, path)) {
+        return;
+    }
+
+    static const char* defaults[] = {
+        "bind Alt+Escape quit",      "bind Alt+F1 focus-next",     "bind Alt+1 workspace 1",
+        "bind Alt+2 workspace 2",    "bind Alt+3 workspace 3",     "bind Alt+4 workspace 4",
+        "bind Alt+5 workspace 5",    "bind Alt+6 workspace 6",     "bind Alt+7 workspace 7",
+        "bind Alt+8 workspace 8",    "bind Alt+9 workspace 9",     "bind Alt+0 workspace 10",
+    };
+    for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+        tm_bindings_parse_line(server->bindings, defaults[i]);
+    }
+}
+
+static void spawn_command(const char* command) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        // double fork so the compositor never has to reap the command
+        if (fork() == 0) {
+            // the event loop blocks the signals it handles, don't pass that on
+            sigset_t set;
+            sigemptyset(&set);
+            sigprocmask(SIG_SETMASK, &set, NULL);
+            setsid();
+            execl("/bin/sh", "/bin/sh", "-c", command, (char*)NULL);
+            _exit(1);
+        }
+        _exit(0);
+    } else if (pid > 0) {
+        waitpid(pid, NULL, 0);
     }
-    return true;
 }
@@ -0,0 +1,77 @@
+#include "histogram.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+
+void tm_histogram_add(struct tm_histogram* histogram, int64_t ns) {
+    if (ns < 0) {
+        ns = 0;
+    }
+
+    uint64_t us     = (uint64_t)ns / 1000;
+    int      bucket = us;
+    if (us >= TM_HISTOGRAM_SUB_BUCKETS) {
+        // sub-buckets are the bits right below the highest set one
+        int octave = 63 - __builtin_clzll(us);
+        int sub    = (us >> (octave - 2)) & (TM_HISTOGRAM_SUB_BUCKETS - 1);
+        bucket     = TM_HISTOGRAM_SUB_BUCKETS * (octave - 1) + sub;
+    }
+    if (bucket >= TM_HISTOGRAM_BUCKETS) {
+        bucket = TM_HISTOGRAM_BUCKETS - 1;
+    }
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_ns += ns;
+    if ((uint64_t)ns > histogram->max_ns) {
+        histogram->max_ns = ns;
+    }
+}
+
+static int64_t bucket_lower_us(int bucket) {
+    if (bucket < TM_HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int octave = bucket / TM_HISTOGRAM_SUB_BUCKETS + 1;
+    int sub    = bucket % TM_HISTOGRAM_SUB_BUCKETS;
+    return (int64_t)(TM_HISTOGRAM_SUB_BUCKETS + sub) << (octave - 2);
+}
+
+int64_t tm_histogram_percentile(const struct tm_histogram* histogram, double fraction) {
+    uint64_t target = ceil(fraction * histogram->count);
+    uint64_t seen   = 0;
+    for (int i = 0; i < TM_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target) {
+            int64_t upper_ns = bucket_lower_us(i + 1) * 1000;
+            return upper_ns < (int64_t)histogram->max_ns ? upper_ns : (int64_t)histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+void tm_histogram_print(const struct tm_histogram* histogram, const char* label, bool buckets) {
+    if (histogram->count == 0) {
+        printf("  %s: no samples\n", label);
+        return;
+    }
+
+    printf("  %s: count=%" PRIu64 " mean=%.3fms p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms\n",
+           label, histogram->count, (double)histogram->sum_ns / histogram->count / 1e6,
+           tm_histogram_percentile(histogram, 0.5) / 1e6,
+           tm_histogram_percentile(histogram, 0.9) / 1e6,
+           tm_histogram_percentile(histogram, 0.99) / 1e6, histogram->max_ns / 1e6);
+    for (int i = 0; buckets && i < TM_HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i] == 0) {
+            continue;
+        }
+        if (i == TM_HISTOGRAM_BUCKETS - 1) {
+            printf("    [%8" PRId64 "us,        inf) %" PRIu64 "\n", bucket_lower_us(i),
+                   histogram->buckets[i]);
+        } else {
+            printf("    [%8" PRId64 "us, %8" PRId64 "us) %" PRIu64 "\n", bucket_lower_us(i),
+                   bucket_lower_us(i + 1), histogram->buckets[i]);
+        }
+    }
+}
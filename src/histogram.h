@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// latency histogram shared by the compositor's stats and the test clients, it knows nothing
+// about wayland
+//
+// log-linear buckets in microseconds: values below TM_HISTOGRAM_SUB_BUCKETS get a bucket each and
+// every power of two above is split into TM_HISTOGRAM_SUB_BUCKETS parts, so percentiles are good
+// to 25% with a fixed array. the last bucket also catches everything above ~1s
+#define TM_HISTOGRAM_SUB_BUCKETS 4
+#define TM_HISTOGRAM_BUCKETS 76
+
+struct tm_histogram {
+    uint64_t buckets[TM_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+};
+
+// negative samples count as 0
+void tm_histogram_add(struct tm_histogram* histogram, int64_t ns);
+
+// upper bound of the bucket holding the given fraction of samples, never above the real max
+int64_t tm_histogram_percentile(const struct tm_histogram* histogram, double fraction);
+
+// one indented summary line, followed by a line per non-empty bucket when buckets is set
+void tm_histogram_print(const struct tm_histogram* histogram, const char* label, bool buckets);
@@ -0,0 +1,346 @@
+#include "layout.h"
+
+#include <stdlib.h>
+
+static bool box_equal(const struct tm_layout_box* a, const struct tm_layout_box* b) {
+    return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
+
+// flags node for a relayout of its children and its ancestors for a walk down to it
+static void mark_dirty(struct tm_layout_node* node) {
+    node->dirty = true;
+    for (struct tm_layout_node* parent = node->parent; parent != NULL && !parent->child_dirty;
+         parent = parent->parent) {
+        parent->child_dirty = true;
+    }
+}
+
+static struct tm_layout_node* node_create(enum tm_layout_kind kind, void* data) {
+    struct tm_layout_node* node = calloc(1, sizeof(struct tm_layout_node));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->kind   = kind;
+    node->weight = 1.0;
+    node->dirty  = true;
+    node->data   = data;
+    return node;
+}
+
+static void node_destroy(struct tm_layout_node* node) {
+    struct tm_layout_node* child = node->first_child;
+    while (child != NULL) {
+        struct tm_layout_node* next = child->next;
+        node_destroy(child);
+        child = next;
+    }
+    free(node);
+}
+
+// links node into parent after prev, or first when prev is NULL
+static void node_link(struct tm_layout_node* parent,
+                      struct tm_layout_node* prev,
+                      struct tm_layout_node* node) {
+    struct tm_layout_node* next = prev != NULL ? prev->next : parent->first_child;
+
+    node->parent = parent;
+    node->prev   = prev;
+    node->next   = next;
+    if (prev != NULL) {
+        prev->next = node;
+    } else {
+        parent->first_child = node;
+    }
+    if (next != NULL) {
+        next->prev = node;
+    } else {
+        parent->last_child = node;
+    }
+}
+
+static void node_unlink(struct tm_layout_node* node) {
+    struct tm_layout_node* parent = node->parent;
+    if (parent->active == node) {
+        parent->active = node->next != NULL ? node->next : node->prev;
+    }
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        parent->first_child = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    } else {
+        parent->last_child = node->prev;
+    }
+    node->parent = NULL;
+    node->prev   = NULL;
+    node->next   = NULL;
+}
+
+// puts node where old is, with old's weight, box and visibility so an unchanged parent doesn't
+// have to lay it out again
+static void node_replace(struct tm_layout_node* old, struct tm_layout_node* node) {
+    struct tm_layout_node* parent = old->parent;
+    struct tm_layout_node* prev   = old->prev;
+    bool                   active = parent->active == old;
+
+    node_unlink(old);
+    node_link(parent, prev, node);
+    node->weight = old->weight;
+    node->box    = old->box;
+    node->hidden = old->hidden;
+    if (active) {
+        parent->active = node;
+    }
+}
+
+bool tm_layout_init(struct tm_layout* layout) {
+    *layout      = (struct tm_layout){0};
+    layout->root = node_create(TM_LAYOUT_SPLIT_H, NULL);
+    return layout->root != NULL;
+}
+
+void tm_layout_finish(struct tm_layout* layout) {
+    node_destroy(layout->root);
+    layout->root    = NULL;
+    layout->changed = NULL;
+}
+
+void tm_layout_set_area(struct tm_layout* layout, struct tm_layout_box area) {
+    if (!box_equal(&layout->area, &area)) {
+        layout->area = area;
+        mark_dirty(layout->root);
+    }
+}
+
+struct tm_layout_node* tm_layout_insert(struct tm_layout*      layout,
+                                        struct tm_layout_node* sibling,
+                                        void*                  data) {
+    struct tm_layout_node* parent = sibling != NULL ? sibling->parent : layout->root;
+    struct tm_layout_node* prev   = sibling != NULL ? sibling : parent->last_child;
+
+    struct tm_layout_node* leaf = node_create(TM_LAYOUT_LEAF, data);
+    if (leaf == NULL) {
+        return NULL;
+    }
+
+    double total = 0.0;
+    int    count = 0;
+    for (struct tm_layout_node* child = parent->first_child; child != NULL; child = child->next) {
+        total += child->weight;
+        count++;
+    }
+    if (count > 0) {
+        leaf->weight = total / count;
+    }
+
+    node_link(parent, prev, leaf);
+    if (parent->kind == TM_LAYOUT_STACK) {
+        parent->active = leaf;
+    }
+    mark_dirty(parent);
+    return leaf;
+}
+
+void tm_layout_remove(struct tm_layout* layout, struct tm_layout_node* leaf) {
+    struct tm_layout_node* parent = leaf->parent;
+    node_unlink(leaf);
+    free(leaf);
+
+    // the root stays even when empty, the layout area hangs off it
+    while (parent != layout->root && parent->first_child == parent->last_child) {
+        struct tm_layout_node* grandparent = parent->parent;
+        struct tm_layout_node* child       = parent->first_child;
+        if (child != NULL) {
+            node_unlink(child);
+            node_replace(parent, child);
+            // the child's boxes were for the container's kind, not the grandparent's
+            mark_dirty(child);
+        } else {
+            node_unlink(parent);
+        }
+        free(parent);
+        parent = grandparent;
+    }
+    mark_dirty(parent);
+}
+
+void tm_layout_set_kind([[maybe_unused]] struct tm_layout* layout,
+                        struct tm_layout_node*             leaf,
+                        enum tm_layout_kind                kind) {
+    struct tm_layout_node* parent = leaf->parent;
+    if (parent->kind == kind) {
+        return;
+    }
+    parent->kind   = kind;
+    parent->active = leaf;
+    mark_dirty(parent);
+}
+
+bool tm_layout_split(struct tm_layout*      layout,
+                     struct tm_layout_node* leaf,
+                     enum tm_layout_kind    kind) {
+    // a container of one already is the split
+    if (leaf->parent->first_child == leaf->parent->last_child) {
+        tm_layout_set_kind(layout, leaf, kind);
+        return true;
+    }
+
+    struct tm_layout_node* container = node_create(kind, NULL);
+    if (container == NULL) {
+        return false;
+    }
+    node_replace(leaf, container);
+    node_link(container, NULL, leaf);
+    leaf->weight      = 1.0;
+    container->active = leaf;
+    mark_dirty(container);
+    return true;
+}
+
+void tm_layout_focus([[maybe_unused]] struct tm_layout* layout, struct tm_layout_node* leaf) {
+    for (struct tm_layout_node* node = leaf; node->parent != NULL; node = node->parent) {
+        if (node->parent->kind == TM_LAYOUT_STACK && node->parent->active != node) {
+            node->parent->active = node;
+            mark_dirty(node->parent);
+        }
+    }
+}
+
+// nearest ancestor split of kind with more than one child, *branch is its child above leaf
+static struct tm_layout_node* split_above(struct tm_layout_node*  leaf,
+                                          enum tm_layout_kind     kind,
+                                          struct tm_layout_node** branch) {
+    for (struct tm_layout_node* node = leaf; node->parent != NULL; node = node->parent) {
+        struct tm_layout_node* parent = node->parent;
+        if (parent->kind == kind && parent->first_child != parent->last_child) {
+            *branch = node;
+            return parent;
+        }
+    }
+    return NULL;
+}
+
+static void split_resize(struct tm_layout_node* leaf, enum tm_layout_kind kind, int size) {
+    struct tm_layout_node* branch;
+    struct tm_layout_node* split = split_above(leaf, kind, &branch);
+    if (split == NULL) {
+        return;
+    }
+
+    int length  = kind == TM_LAYOUT_SPLIT_H ? split->box.width : split->box.height;
+    int current = kind == TM_LAYOUT_SPLIT_H ? branch->box.width : branch->box.height;
+    if (length < 2 || size == current) {
+        return;
+    }
+    if (size < 1) {
+        size = 1;
+    } else if (size > length - 1) {
+        size = length - 1;
+    }
+
+    double others = 0.0;
+    int    count  = 0;
+    for (struct tm_layout_node* child = split->first_child; child != NULL; child = child->next) {
+        if (child != branch) {
+            others += child->weight;
+        }
+        count++;
+    }
+    // weight / (weight + others) == size / length
+    branch->weight = others * size / (length - size);
+
+    // rescaled to sum up to the child count so repeated resizes don't drift towards 0 or inf
+    double scale = count / (others + branch->weight);
+    for (struct tm_layout_node* child = split->first_child; child != NULL; child = child->next) {
+        child->weight *= scale;
+    }
+    mark_dirty(split);
+}
+
+void tm_layout_set_size([[maybe_unused]] struct tm_layout* layout,
+                        struct tm_layout_node*             leaf,
+                        int                                width,
+                        int                                height) {
+    split_resize(leaf, TM_LAYOUT_SPLIT_H, width);
+    split_resize(leaf, TM_LAYOUT_SPLIT_V, height);
+}
+
+static void arrange_node(struct tm_layout*      layout,
+                         struct tm_layout_node* node,
+                         struct tm_layout_box   box,
+                         bool                   hidden) {
+    layout->visited++;
+    if (!box_equal(&node->box, &box) || node->hidden != hidden) {
+        node->box    = box;
+        node->hidden = hidden;
+        node->dirty  = true;
+    }
+
+    if (node->kind == TM_LAYOUT_LEAF) {
+        if (node->dirty) {
+            node->changed_next = layout->changed;
+            layout->changed    = node;
+            node->dirty        = false;
+        }
+        return;
+    }
+    if (!node->dirty && !node->child_dirty) {
+        return;
+    }
+
+    bool relayout     = node->dirty;
+    node->dirty       = false;
+    node->child_dirty = false;
+
+    // only some descendants changed, this container's own split stays as it is
+    if (!relayout) {
+        for (struct tm_layout_node* child = node->first_child; child != NULL; child = child->next) {
+            if (child->dirty || child->child_dirty) {
+                arrange_node(layout, child, child->box, child->hidden);
+            }
+        }
+        return;
+    }
+
+    if (node->kind == TM_LAYOUT_STACK) {
+        for (struct tm_layout_node* child = node->first_child; child != NULL; child = child->next) {
+            arrange_node(layout, child, box, hidden || child != node->active);
+        }
+        return;
+    }
+
+    double total = 0.0;
+    for (struct tm_layout_node* child = node->first_child; child != NULL; child = child->next) {
+        total += child->weight;
+    }
+
+    // edges are rounded from the running weight, so the children always fill the box exactly
+    bool   horizontal = node->kind == TM_LAYOUT_SPLIT_H;
+    int    length     = horizontal ? box.width : box.height;
+    int    start      = 0;
+    double weight     = 0.0;
+    for (struct tm_layout_node* child = node->first_child; child != NULL; child = child->next) {
+        weight += child->weight;
+        int end = child->next == NULL ? length : (int)(weight * length / total + 0.5);
+
+        struct tm_layout_box child_box = box;
+        if (horizontal) {
+            child_box.x     = box.x + start;
+            child_box.width = end - start;
+        } else {
+            child_box.y      = box.y + start;
+            child_box.height = end - start;
+        }
+        arrange_node(layout, child, child_box, hidden);
+        start = end;
+    }
+}
+
+struct tm_layout_node* tm_layout_arrange(struct tm_layout* layout) {
+    layout->changed = NULL;
+    layout->visited = 0;
+    arrange_node(layout, layout->root, layout->area, false);
+    return layout->changed;
+}
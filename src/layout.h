@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+
+// tiling layout tree. it knows nothing about wlroots so it can be benchmarked on its own, the
+// leaves carry the compositor's window in data
+enum tm_layout_kind {
+    TM_LAYOUT_LEAF,
+    // children side by side, each getting a share of the width proportional to its weight
+    TM_LAYOUT_SPLIT_H,
+    // children on top of each other, sharing the height
+    TM_LAYOUT_SPLIT_V,
+    // every child gets the whole box, only the active one is shown
+    TM_LAYOUT_STACK,
+};
+
+struct tm_layout_box {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+struct tm_layout_node {
+    enum tm_layout_kind    kind;
+    struct tm_layout_node* parent;
+    struct tm_layout_node* first_child;
+    struct tm_layout_node* last_child;
+    struct tm_layout_node* prev;
+    struct tm_layout_node* next;
+    // share of the parent split relative to the siblings' weights
+    double                 weight;
+    // child shown by a stack container
+    struct tm_layout_node* active;
+    struct tm_layout_box   box;
+    // inside a stack behind another child
+    bool                   hidden;
+    // dirty: the children have to be laid out again, child_dirty: some descendant is dirty
+    bool                   dirty;
+    bool                   child_dirty;
+    // leaves whose box or visibility changed in the last pass
+    struct tm_layout_node* changed_next;
+    void*                  data;
+};
+
+struct tm_layout {
+    struct tm_layout_node* root;
+    struct tm_layout_box   area;
+    // the leaves changed by the last tm_layout_arrange, linked through changed_next
+    struct tm_layout_node* changed;
+    // nodes the last pass looked at
+    int                    visited;
+};
+
+// the root is a horizontal split, false if it can't be allocated
+bool tm_layout_init(struct tm_layout* layout);
+void tm_layout_finish(struct tm_layout* layout);
+
+void tm_layout_set_area(struct tm_layout* layout, struct tm_layout_box area);
+
+// adds a leaf right after sibling in its container, or at the end of the root when sibling is
+// NULL. it gets the siblings' average weight and becomes the active child of a stack
+struct tm_layout_node* tm_layout_insert(struct tm_layout*      layout,
+                                        struct tm_layout_node* sibling,
+                                        void*                  data);
+
+// removes and frees a leaf, containers left with a single child are replaced by it
+void tm_layout_remove(struct tm_layout* layout, struct tm_layout_node* leaf);
+
+// changes the kind of the container holding leaf
+void tm_layout_set_kind(struct tm_layout*      layout,
+                        struct tm_layout_node* leaf,
+                        enum tm_layout_kind    kind);
+
+// wraps leaf in a new container of kind, so leaves inserted next to it share its box
+bool tm_layout_split(struct tm_layout*      layout,
+                     struct tm_layout_node* leaf,
+                     enum tm_layout_kind    kind);
+
+// makes leaf the active child of every stack above it
+void tm_layout_focus(struct tm_layout* layout, struct tm_layout_node* leaf);
+
+// reweights the nearest horizontal and vertical splits above leaf so it gets close to the
+// requested size, the siblings keep their proportions
+void tm_layout_set_size(struct tm_layout*      layout,
+                        struct tm_layout_node* leaf,
+                        int                    width,
+                        int                    height);
+
+// lays out only the dirty subtrees and returns the changed leaves, each of them once
+struct tm_layout_node* tm_layout_arrange(struct tm_layout* layout);
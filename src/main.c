@@ -0,0 +1,7 @@
+#include <stddef.h>
+
+#include "server.h"
+
+int main(void) {
+    return tm_server_run(NULL);
+}
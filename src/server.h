@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct tm_server;
+struct wl_display;
+struct wl_event_loop;
+struct wlr_backend;
+struct wlr_renderer;
+
+// lets another program drive the compositor, tm-bench runs it headless next to its synthetic
+// clients. tm-server passes no hooks and gets the session backend
+struct tm_server_hooks {
+    void* data;
+    // replaces wlr_backend_autocreate and wlr_renderer_autocreate, false aborts the start
+    bool (*create_backend)(void*                 data,
+                           struct wl_event_loop* loop,
+                           struct wlr_backend**  backend,
+                           struct wlr_renderer** renderer);
+    // the backend runs and clients can connect to socket, the compositor prints nothing itself
+    void (*started)(void*               data,
+                    struct tm_server*   server,
+                    struct wl_display*  display,
+                    struct wlr_backend* backend,
+                    const char*         socket);
+    // wl_display_run returned, event sources added in started have to go now
+    void (*stopped)(void* data);
+};
+
+// runs the compositor until the display is terminated, hooks may be NULL
+int tm_server_run(const struct tm_server_hooks* hooks);
+
+// what kill -USR1 prints
+void tm_server_dump_stats(struct tm_server* server);
+
+// frames committed over all outputs so far
+uint64_t tm_server_frame_count(struct tm_server* server);
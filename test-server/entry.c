@@ -1,22 +1,623 @@
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <wayland-server.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
 
-int main() {
-    struct wl_display* display = wl_display_create();
-    if (!display) {
-        fprintf(stderr, "Unable to create Wayland display.\n");
+#include "connection.h"
+#include "histogram.h"
+#include "xdg-shell-client-protocol.h"
+
+// load generator for tm-server: K toplevels animating a damage rectangle on a timer, optional
+// popup spam, and frame callback round-trip times measured from the commit that requested them
+
+#define TS_BUFFER_COUNT 3
+#define TS_POPUP_SIZE 96
+#define TS_BACKGROUND 0xff202020
+
+struct ts_rect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+struct ts_options {
+    int windows;
+    int width;
+    int height;
+    int damage_width;
+    int damage_height;
+    // damage updates per second, every window is redrawn on each tick
+    int damage_rate;
+    // popups per second, handed out round robin over the windows
+    int popup_rate;
+    // 0 runs until SIGINT or SIGTERM
+    int duration_s;
+};
+
+struct ts_buffer {
+    struct wl_buffer* buffer;
+    uint32_t*         data;
+    bool              busy;
+    bool              drawn;
+    // the only non background pixels in the buffer
+    struct ts_rect    rect;
+};
+
+struct ts_popup {
+    struct ts_window*   window;
+    struct wl_surface*  surface;
+    struct xdg_surface* xdg_surface;
+    struct xdg_popup*   xdg_popup;
+    int64_t             created_ns;
+    bool                configured;
+};
+
+struct ts_window {
+    struct ts_client*    client;
+    struct wl_surface*   surface;
+    struct xdg_surface*  xdg_surface;
+    struct xdg_toplevel* xdg_toplevel;
+    struct ts_buffer     buffers[TS_BUFFER_COUNT];
+    // size of the buffers and the mapping they live in, replaced when a configure resizes
+    int                  width;
+    int                  height;
+    uint8_t*             pool_data;
+    size_t               pool_size;
+    // size of the last toplevel configure, 0 leaves it to the window
+    int                  configure_width;
+    int                  configure_height;
+    struct wl_callback*  frame_callback;
+    int64_t              frame_requested_ns;
+    // rectangle in the last committed buffer and the direction it moves in
+    struct ts_rect       rect;
+    int                  dx;
+    int                  dy;
+    bool                 configured;
+    bool                 committed;
+    struct ts_popup*     popup;
+};
+
+struct ts_client {
+    struct ts_options       options;
+    struct bench_connection connection;
+    struct ts_window*       windows;
+    struct wl_buffer*       popup_buffer;
+    int                     next_popup_window;
+    bool                    running;
+    uint64_t                ticks;
+    uint64_t                commits;
+    uint64_t                dropped;
+    uint64_t                popups;
+    uint64_t                popups_dismissed;
+    struct tm_histogram     frame_rtt;
+    struct tm_histogram     popup_configure;
+    int64_t                 start_ns;
+};
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+static void print_stats(struct ts_client* client) {
+    double elapsed_s = (monotonic_ns() - client->start_ns) / 1e9;
+
+    int outstanding = 0;
+    for (int i = 0; i < client->options.windows; i++) {
+        outstanding += client->windows[i].frame_callback != NULL;
+    }
+
+    printf("windows=%d elapsed=%.1fs ticks=%" PRIu64 " commits=%" PRIu64
+           " (%.1f/s) dropped=%" PRIu64 "\n",
+           client->options.windows, elapsed_s, client->ticks, client->commits,
+           client->commits / elapsed_s, client->dropped);
+    printf("popups=%" PRIu64 " dismissed=%" PRIu64 "\n", client->popups, client->popups_dismissed);
+    // callbacks of surfaces the compositor doesn't show stay outstanding
+    printf("frame callbacks outstanding=%d\n", outstanding);
+    tm_histogram_print(&client->frame_rtt, "frame callback rtt", false);
+    tm_histogram_print(&client->popup_configure, "popup configure", false);
+    fflush(stdout);
+}
+
+static void fill_rect(uint32_t* data, int stride, const struct ts_rect* rect, uint32_t color) {
+    for (int y = rect->y; y < rect->y + rect->height; y++) {
+        uint32_t* row = data + (size_t)y * stride;
+        for (int x = rect->x; x < rect->x + rect->width; x++) {
+            row[x] = color;
+        }
+    }
+}
+
+static void buffer_release(void* data, [[maybe_unused]] struct wl_buffer* wl_buffer) {
+    struct ts_buffer* buffer = data;
+    buffer->busy             = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+// replaces the window's buffers with fresh ones of the given size, the old ones are destroyed
+// even if the compositor still holds them since it keeps its own mapping of the pool
+static bool create_window_buffers(struct ts_window* window, int width, int height) {
+    struct ts_client* client = window->client;
+    int               stride = width * 4;
+    size_t            size   = (size_t)stride * height;
+
+    uint8_t*            data;
+    struct wl_shm_pool* pool =
+        bench_shm_pool_create(&client->connection, size * TS_BUFFER_COUNT, &data);
+    if (pool == NULL) {
+        return false;
+    }
+
+    if (window->pool_data != NULL) {
+        for (int i = 0; i < TS_BUFFER_COUNT; i++) {
+            wl_buffer_destroy(window->buffers[i].buffer);
+        }
+        munmap(window->pool_data, window->pool_size);
+    }
+    window->pool_data = data;
+    window->pool_size = size * TS_BUFFER_COUNT;
+    window->width     = width;
+    window->height    = height;
+
+    for (int i = 0; i < TS_BUFFER_COUNT; i++) {
+        struct ts_buffer* buffer = &window->buffers[i];
+        *buffer                  = (struct ts_buffer){.data = (uint32_t*)(data + size * i)};
+        buffer->buffer           = wl_shm_pool_create_buffer(pool, size * i, width, height, stride,
+                                                             WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+    }
+    wl_shm_pool_destroy(pool);
+
+    // the rectangle has to fit, and the first buffer of the new size is damaged whole
+    const struct ts_options* options = &client->options;
+    struct ts_rect*          rect    = &window->rect;
+    rect->width  = options->damage_width < width ? options->damage_width : width;
+    rect->height = options->damage_height < height ? options->damage_height : height;
+    rect->x      = rect->x + rect->width > width ? width - rect->width : rect->x;
+    rect->y      = rect->y + rect->height > height ? height - rect->height : rect->y;
+
+    window->committed = false;
+    return true;
+}
+
+// popups all show the same static buffer, it is never written after creation
+static bool create_popup_buffer(struct ts_client* client) {
+    int    stride = TS_POPUP_SIZE * 4;
+    size_t size   = (size_t)stride * TS_POPUP_SIZE;
+
+    uint8_t*            data;
+    struct wl_shm_pool* pool = bench_shm_pool_create(&client->connection, size, &data);
+    if (pool == NULL) {
+        return false;
+    }
+
+    struct ts_rect rect = {0, 0, TS_POPUP_SIZE, TS_POPUP_SIZE};
+    fill_rect((uint32_t*)data, TS_POPUP_SIZE, &rect, 0xff4060a0);
+    client->popup_buffer = wl_shm_pool_create_buffer(pool, 0, TS_POPUP_SIZE, TS_POPUP_SIZE,
+                                                     stride, WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    return true;
+}
+
+static void frame_done(void* data, struct wl_callback* callback, [[maybe_unused]] uint32_t time) {
+    struct ts_window* window = data;
+    tm_histogram_add(&window->client->frame_rtt, monotonic_ns() - window->frame_requested_ns);
+    wl_callback_destroy(callback);
+    window->frame_callback = NULL;
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = frame_done,
+};
+
+static void move_rect(struct ts_window* window) {
+    struct ts_rect* rect = &window->rect;
+
+    rect->x += window->dx;
+    rect->y += window->dy;
+    if (rect->x < 0 || rect->x + rect->width > window->width) {
+        window->dx = -window->dx;
+        rect->x    = rect->x < 0 ? 0 : window->width - rect->width;
+    }
+    if (rect->y < 0 || rect->y + rect->height > window->height) {
+        window->dy = -window->dy;
+        rect->y    = rect->y < 0 ? 0 : window->height - rect->height;
+    }
+}
+
+// moves the rectangle and commits a buffer damaged where it was and where it is now, the tick is
+// dropped when the compositor still holds every buffer
+static void draw_window(struct ts_window* window) {
+    struct ts_client* client = window->client;
+    int               width  = window->width;
+    int               height = window->height;
+
+    struct ts_buffer* buffer = NULL;
+    for (int i = 0; i < TS_BUFFER_COUNT; i++) {
+        if (!window->buffers[i].busy) {
+            buffer = &window->buffers[i];
+            break;
+        }
+    }
+    if (buffer == NULL) {
+        client->dropped++;
+        return;
+    }
+
+    struct ts_rect previous = window->rect;
+    move_rect(window);
+
+    if (buffer->drawn) {
+        fill_rect(buffer->data, width, &buffer->rect, TS_BACKGROUND);
+    } else {
+        struct ts_rect full = {0, 0, width, height};
+        fill_rect(buffer->data, width, &full, TS_BACKGROUND);
+        buffer->drawn = true;
+    }
+    uint32_t color = 0xff000000 | (uint32_t)(client->commits * 0x010307);
+    fill_rect(buffer->data, width, &window->rect, color);
+    buffer->rect = window->rect;
+    buffer->busy = true;
+
+    wl_surface_attach(window->surface, buffer->buffer, 0, 0);
+    if (window->committed) {
+        wl_surface_damage_buffer(window->surface, previous.x, previous.y, previous.width,
+                                 previous.height);
+        wl_surface_damage_buffer(window->surface, window->rect.x, window->rect.y,
+                                 window->rect.width, window->rect.height);
+    } else {
+        wl_surface_damage_buffer(window->surface, 0, 0, width, height);
+    }
+
+    // one callback in flight per window, so each sample is a clean commit to done round trip
+    if (window->frame_callback == NULL) {
+        window->frame_callback     = wl_surface_frame(window->surface);
+        window->frame_requested_ns = monotonic_ns();
+        wl_callback_add_listener(window->frame_callback, &frame_listener, window);
+    }
+
+    wl_surface_commit(window->surface);
+    window->committed = true;
+    client->commits++;
+}
+
+static void popup_destroy(struct ts_popup* popup) {
+    popup->window->popup = NULL;
+    xdg_popup_destroy(popup->xdg_popup);
+    xdg_surface_destroy(popup->xdg_surface);
+    wl_surface_destroy(popup->surface);
+    free(popup);
+}
+
+static void popup_surface_configure(void* data, struct xdg_surface* xdg_surface, uint32_t serial) {
+    struct ts_popup* popup = data;
+    xdg_surface_ack_configure(xdg_surface, serial);
+    if (popup->configured) {
+        wl_surface_commit(popup->surface);
+        return;
+    }
+
+    popup->configured = true;
+    tm_histogram_add(&popup->window->client->popup_configure, monotonic_ns() - popup->created_ns);
+    wl_surface_attach(popup->surface, popup->window->client->popup_buffer, 0, 0);
+    wl_surface_damage_buffer(popup->surface, 0, 0, TS_POPUP_SIZE, TS_POPUP_SIZE);
+    wl_surface_commit(popup->surface);
+}
+
+static const struct xdg_surface_listener popup_surface_listener = {
+    .configure = popup_surface_configure,
+};
+
+static void popup_configure([[maybe_unused]] void*             data,
+                            [[maybe_unused]] struct xdg_popup* xdg_popup,
+                            [[maybe_unused]] int32_t           x,
+                            [[maybe_unused]] int32_t           y,
+                            [[maybe_unused]] int32_t           width,
+                            [[maybe_unused]] int32_t           height) {}
+
+static void popup_done(void* data, [[maybe_unused]] struct xdg_popup* xdg_popup) {
+    struct ts_popup* popup = data;
+    popup->window->client->popups_dismissed++;
+    popup_destroy(popup);
+}
+
+static void popup_repositioned([[maybe_unused]] void*             data,
+                               [[maybe_unused]] struct xdg_popup* xdg_popup,
+                               [[maybe_unused]] uint32_t          token) {}
+
+static const struct xdg_popup_listener popup_listener = {
+    .configure    = popup_configure,
+    .popup_done   = popup_done,
+    .repositioned = popup_repositioned,
+};
+
+// replaces the popup of the next window in line with a new one anchored somewhere random in it
+static void spawn_popup(struct ts_client* client) {
+    struct ts_window* window = &client->windows[client->next_popup_window];
+    client->next_popup_window = (client->next_popup_window + 1) % client->options.windows;
+    if (!window->configured) {
+        return;
+    }
+    if (window->popup != NULL) {
+        popup_destroy(window->popup);
+    }
+
+    struct ts_popup* popup = calloc(1, sizeof(struct ts_popup));
+    popup->window          = window;
+    popup->created_ns      = monotonic_ns();
+
+    struct xdg_positioner* positioner = xdg_wm_base_create_positioner(client->connection.wm_base);
+    xdg_positioner_set_size(positioner, TS_POPUP_SIZE, TS_POPUP_SIZE);
+    xdg_positioner_set_anchor_rect(positioner, rand() % window->width, rand() % window->height,
+                                   1, 1);
+
+    popup->surface     = wl_compositor_create_surface(client->connection.compositor);
+    popup->xdg_surface = xdg_wm_base_get_xdg_surface(client->connection.wm_base, popup->surface);
+    popup->xdg_popup   = xdg_surface_get_popup(popup->xdg_surface, window->xdg_surface, positioner);
+    xdg_positioner_destroy(positioner);
+
+    xdg_surface_add_listener(popup->xdg_surface, &popup_surface_listener, popup);
+    xdg_popup_add_listener(popup->xdg_popup, &popup_listener, popup);
+    wl_surface_commit(popup->surface);
+
+    window->popup = popup;
+    client->popups++;
+}
+
+// a tiled, maximized or fullscreen window is only caught up with a layout change once it
+// committed a buffer of the configured size, so that one goes out right away like in a real client
+static void window_surface_configure(void* data, struct xdg_surface* xdg_surface, uint32_t serial) {
+    struct ts_window* window = data;
+    int               width  = window->width;
+    int               height = window->height;
+    if (window->configure_width > 0) {
+        width = window->configure_width;
+    }
+    if (window->configure_height > 0) {
+        height = window->configure_height;
+    }
+    bool resize = width != window->width || height != window->height;
+
+    xdg_surface_ack_configure(xdg_surface, serial);
+    if (resize && !create_window_buffers(window, width, height)) {
+        fprintf(stderr, "Unable to allocate buffers.\n");
+        window->client->running = false;
+        return;
+    }
+    if (!window->configured || resize) {
+        window->configured = true;
+        draw_window(window);
+    }
+}
+
+static const struct xdg_surface_listener window_surface_listener = {
+    .configure = window_surface_configure,
+};
+
+// applied by the xdg_surface configure that ends the sequence, a floating window keeps the size
+// given on the command line
+static void window_configure(void*                                data,
+                             [[maybe_unused]] struct xdg_toplevel* xdg_toplevel,
+                             int32_t                              width,
+                             int32_t                              height,
+                             [[maybe_unused]] struct wl_array*     states) {
+    struct ts_window* window = data;
+    window->configure_width  = width;
+    window->configure_height = height;
+}
+
+static void window_close(void* data, [[maybe_unused]] struct xdg_toplevel* xdg_toplevel) {
+    struct ts_window* window = data;
+    window->client->running  = false;
+}
+
+static void window_configure_bounds([[maybe_unused]] void*                data,
+                                    [[maybe_unused]] struct xdg_toplevel* xdg_toplevel,
+                                    [[maybe_unused]] int32_t              width,
+                                    [[maybe_unused]] int32_t              height) {}
+
+static void window_wm_capabilities([[maybe_unused]] void*                data,
+                                   [[maybe_unused]] struct xdg_toplevel* xdg_toplevel,
+                                   [[maybe_unused]] struct wl_array*     capabilities) {}
+
+static const struct xdg_toplevel_listener window_listener = {
+    .configure        = window_configure,
+    .close            = window_close,
+    .configure_bounds = window_configure_bounds,
+    .wm_capabilities  = window_wm_capabilities,
+};
+
+static bool create_window(struct ts_client* client, struct ts_window* window, int index) {
+    const struct ts_options* options = &client->options;
+
+    // spread the rectangles out so the windows don't all damage the same spot
+    window->client      = client;
+    window->rect.x      = (index * 37) % (options->width - options->damage_width + 1);
+    window->rect.y      = (index * 53) % (options->height - options->damage_height + 1);
+    window->rect.width  = options->damage_width;
+    window->rect.height = options->damage_height;
+    window->dx          = index % 2 == 0 ? 4 : -4;
+    window->dy          = index % 3 == 0 ? 3 : -3;
+
+    if (!create_window_buffers(window, options->width, options->height)) {
+        return false;
+    }
+
+    char title[32];
+    snprintf(title, sizeof(title), "test-server %d", index);
+
+    window->surface      = wl_compositor_create_surface(client->connection.compositor);
+    window->xdg_surface  = xdg_wm_base_get_xdg_surface(client->connection.wm_base, window->surface);
+    window->xdg_toplevel = xdg_surface_get_toplevel(window->xdg_surface);
+    xdg_surface_add_listener(window->xdg_surface, &window_surface_listener, window);
+    xdg_toplevel_add_listener(window->xdg_toplevel, &window_listener, window);
+    xdg_toplevel_set_title(window->xdg_toplevel, title);
+    wl_surface_commit(window->surface);
+    return true;
+}
+
+static bool parse_size(const char* arg, int* width, int* height) {
+    return sscanf(arg, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+static bool parse_options(struct ts_options* options, int argc, char** argv) {
+    *options = (struct ts_options){
+        .windows       = 4,
+        .width         = 640,
+        .height        = 480,
+        .damage_width  = 64,
+        .damage_height = 64,
+        .damage_rate   = 60,
+        .popup_rate    = 0,
+        .duration_s    = 0,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:s:d:f:p:t:h")) != -1) {
+        switch (opt) {
+        case 'k': options->windows = atoi(optarg); break;
+        case 'f': options->damage_rate = atoi(optarg); break;
+        case 'p': options->popup_rate = atoi(optarg); break;
+        case 't': options->duration_s = atoi(optarg); break;
+        case 's':
+            if (!parse_size(optarg, &options->width, &options->height)) {
+                return false;
+            }
+            break;
+        case 'd':
+            if (!parse_size(optarg, &options->damage_width, &options->damage_height)) {
+                return false;
+            }
+            break;
+        default: return false;
+        }
+    }
+
+    if (options->damage_width > options->width) {
+        options->damage_width = options->width;
+    }
+    if (options->damage_height > options->height) {
+        options->damage_height = options->height;
+    }
+    return options->windows > 0 && options->damage_rate > 0 && options->popup_rate >= 0 &&
+           options->duration_s >= 0;
+}
+
+int main(int argc, char** argv) {
+    struct ts_client client = {0};
+    if (!parse_options(&client.options, argc, argv)) {
+        fprintf(stderr,
+                "usage: %s [-k windows] [-s WxH] [-d damage WxH] [-f damage/s] [-p popups/s] "
+                "[-t seconds]\n",
+                argv[0]);
         return 1;
     }
 
-    const char* socket = wl_display_add_socket_auto(display);
-    if (!socket) {
-        fprintf(stderr, "Unable to add socket to Wayland display.\n");
+    // SIGUSR1 prints stats so far, SIGINT and SIGTERM print them and exit
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        fprintf(stderr, "Unable to create signalfd.\n");
         return 1;
     }
 
-    fprintf(stderr, "Running Wayland display on %s\n", socket);
-    wl_display_run(display);
+    if (!bench_connection_open(&client.connection, NULL)) {
+        if (client.connection.display == NULL) {
+            fprintf(stderr, "Unable to connect to Wayland display.\n");
+        } else {
+            fprintf(stderr, "Compositor lacks wl_compositor, wl_shm or xdg_wm_base.\n");
+        }
+        return 1;
+    }
+
+    client.windows = calloc(client.options.windows, sizeof(struct ts_window));
+    if (client.windows == NULL || !create_popup_buffer(&client)) {
+        fprintf(stderr, "Unable to allocate buffers.\n");
+        return 1;
+    }
+    for (int i = 0; i < client.options.windows; i++) {
+        if (!create_window(&client, &client.windows[i], i)) {
+            fprintf(stderr, "Unable to allocate buffers.\n");
+            return 1;
+        }
+    }
+
+    client.running  = true;
+    client.start_ns = monotonic_ns();
+
+    struct pollfd fds[5] = {
+        {.fd = wl_display_get_fd(client.connection.display), .events = POLLIN},
+        {.fd = signal_fd, .events = POLLIN},
+        {.fd = bench_timer_create(client.options.damage_rate), .events = POLLIN},
+        {.fd = bench_timer_create(client.options.popup_rate), .events = POLLIN},
+        {.fd = -1, .events = POLLIN},
+    };
+    if (client.options.duration_s > 0) {
+        fds[4].fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
 
-    wl_display_destroy(display);
+        struct itimerspec spec = {.it_value.tv_sec = client.options.duration_s};
+        if (fds[4].fd >= 0 && timerfd_settime(fds[4].fd, 0, &spec, NULL) != 0) {
+            close(fds[4].fd);
+            fds[4].fd = -1;
+        }
+    }
+    // without them the run would go on forever and never report anything
+    if (fds[2].fd < 0 || (client.options.popup_rate > 0 && fds[3].fd < 0) ||
+        (client.options.duration_s > 0 && fds[4].fd < 0)) {
+        fprintf(stderr, "Unable to create timers.\n");
+        return 1;
+    }
+
+    while (client.running && bench_connection_dispatch(&client.connection, fds, 5)) {
+        if (fds[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                print_stats(&client);
+                client.running = info.ssi_signo == SIGUSR1;
+            }
+        }
+        if (bench_timer_fired(&fds[2])) {
+            client.ticks++;
+            for (int i = 0; i < client.options.windows; i++) {
+                if (client.windows[i].configured) {
+                    draw_window(&client.windows[i]);
+                }
+            }
+        }
+        if (bench_timer_fired(&fds[3])) {
+            spawn_popup(&client);
+        }
+        if (bench_timer_fired(&fds[4])) {
+            print_stats(&client);
+            client.running = false;
+        }
+    }
+
+    for (int i = 1; i < 5; i++) {
+        if (fds[i].fd >= 0) {
+            close(fds[i].fd);
+        }
+    }
+    bench_connection_close(&client.connection);
+    free(client.windows);
     return 0;
 }